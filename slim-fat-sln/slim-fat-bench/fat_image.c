@@ -0,0 +1,240 @@
+#include "fat_image.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SECTOR_SIZE		512
+#define ENTRY_SIZE		32
+#define PARTITION_START	2048
+#define NUM_FATS		2
+#define END_OF_CHAIN	0x0FFFFFFF
+
+#define ATTR_DIRECTORY	0x10
+#define ATTR_ARCHIVE	0x20
+
+static void put16(uint8_t* buffer, const uint16_t value) {
+	memcpy(buffer, &value, sizeof(uint16_t));
+}
+
+static void put32(uint8_t* buffer, const uint32_t value) {
+	memcpy(buffer, &value, sizeof(uint32_t));
+}
+
+static int write_sectors(fat_image_t* image, const uint32_t sector, const void* data, const size_t size) {
+	return (pwrite(image->fd, data, size, (off_t)sector * SECTOR_SIZE) == (ssize_t)size) ? 0 : -1;
+}
+
+static uint32_t cluster_sector(const fat_image_t* image, const uint32_t cluster) {
+	uint32_t data_start = image->partition_start + image->reserved_sectors + NUM_FATS * image->sectors_per_fat;
+	return data_start + (cluster - 2) * image->sectors_per_cluster;
+}
+
+static uint32_t alloc_chain(fat_image_t* image, const uint32_t count) {
+	if (0 == count || image->next_free + count > image->clusters + 2) return 0;
+
+	uint32_t first = image->next_free;
+	for (uint32_t i = 0; i < count; i++) {
+		image->fat[first + i] = (i + 1 < count) ? first + i + 1 : END_OF_CHAIN;
+	}
+	image->next_free += count;
+	return first;
+}
+
+static void short_name(uint8_t* entry, const char* name) {
+	memset(entry, ' ', 11);
+	const char* dot = strchr(name, '.');
+	size_t base = dot ? (size_t)(dot - name) : strlen(name);
+	for (size_t i = 0; i < base && i < 8; i++) entry[i] = toupper((unsigned char)name[i]);
+	if (dot) {
+		for (size_t i = 0; dot[i + 1] && i < 3; i++) entry[8 + i] = toupper((unsigned char)dot[i + 1]);
+	}
+}
+
+static uint8_t* new_entry(fat_image_t* image, const int parent) {
+	fat_image_dir* dir = &image->dirs[parent];
+	if (dir->count == dir->capacity) {
+		size_t capacity = dir->capacity ? dir->capacity * 2 : 16;
+		uint8_t* entries = realloc(dir->entries, capacity * ENTRY_SIZE);
+		if (NULL == entries) return NULL;
+		dir->entries = entries;
+		dir->capacity = capacity;
+	}
+	uint8_t* entry = &dir->entries[dir->count++ * ENTRY_SIZE];
+	memset(entry, 0, ENTRY_SIZE);
+	return entry;
+}
+
+static void fill_entry(uint8_t* entry, const char* name, const uint8_t attributes, const uint32_t cluster, const uint32_t size) {
+	if (0 == strcmp(name, ".") || 0 == strcmp(name, "..")) {
+		memset(entry, ' ', 11);
+		memcpy(entry, name, strlen(name));
+	}
+	else {
+		short_name(entry, name);
+	}
+	entry[11] = attributes;
+	put16(&entry[0x14], cluster >> 16);
+	put16(&entry[0x1A], cluster & 0xFFFF);
+	put32(&entry[0x1C], size);
+}
+
+static int new_dir(fat_image_t* image, const uint32_t cluster) {
+	fat_image_dir* dirs = realloc(image->dirs, (image->dir_count + 1) * sizeof(fat_image_dir));
+	if (NULL == dirs) return -1;
+	image->dirs = dirs;
+	memset(&dirs[image->dir_count], 0, sizeof(fat_image_dir));
+	dirs[image->dir_count].cluster = cluster;
+	return (int)image->dir_count++;
+}
+
+int fat_image_create(fat_image_t* image, const char* path, const uint32_t size_mb, const uint8_t sectors_per_cluster) {
+	memset(image, 0, sizeof(fat_image_t));
+	image->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (image->fd < 0) return -1;
+
+	uint32_t total_sectors = size_mb * (1024 * 1024 / SECTOR_SIZE);
+	image->partition_start = PARTITION_START;
+	image->partition_sectors = total_sectors - PARTITION_START;
+	image->sectors_per_cluster = sectors_per_cluster;
+	image->reserved_sectors = 32;
+
+	// Grow FAT until it can describe all remaining data clusters
+	uint32_t sectors_per_fat = 1;
+	for (;;) {
+		uint32_t data_sectors = image->partition_sectors - image->reserved_sectors - NUM_FATS * sectors_per_fat;
+		image->clusters = data_sectors / sectors_per_cluster;
+		uint32_t needed = ((image->clusters + 2) * 4 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+		if (needed <= sectors_per_fat) break;
+		sectors_per_fat = needed;
+	}
+	image->sectors_per_fat = sectors_per_fat;
+
+	if (ftruncate(image->fd, (off_t)total_sectors * SECTOR_SIZE)) return -1;
+	image->fat = calloc((size_t)sectors_per_fat * SECTOR_SIZE / 4, sizeof(uint32_t));
+	if (NULL == image->fat) return -1;
+	image->fat[0] = 0x0FFFFFF8;
+	image->fat[1] = END_OF_CHAIN;
+	image->next_free = 2;
+
+	// Root directory always starts at cluster 2
+	return (FAT_IMAGE_ROOT == new_dir(image, alloc_chain(image, 1))) ? 0 : -1;
+}
+
+int fat_image_add_dir(fat_image_t* image, const int parent, const char* name) {
+	uint32_t cluster = alloc_chain(image, 1);
+	uint8_t* entry = new_entry(image, parent);
+	if (0 == cluster || NULL == entry) return -1;
+	fill_entry(entry, name, ATTR_DIRECTORY, cluster, 0);
+
+	int dir = new_dir(image, cluster);
+	if (dir < 0) return -1;
+	entry = new_entry(image, dir);
+	if (NULL == entry) return -1;
+	fill_entry(entry, ".", ATTR_DIRECTORY, cluster, 0);
+	entry = new_entry(image, dir);
+	if (NULL == entry) return -1;
+	fill_entry(entry, "..", ATTR_DIRECTORY, (FAT_IMAGE_ROOT == parent) ? 0 : image->dirs[parent].cluster, 0);
+	return dir;
+}
+
+int fat_image_add_file(fat_image_t* image, const int parent, const char* name, const uint8_t* data, const uint32_t size) {
+	uint32_t cluster_size = (uint32_t)image->sectors_per_cluster * SECTOR_SIZE;
+	uint32_t clusters = (size + cluster_size - 1) / cluster_size;
+	uint32_t first = 0;
+	if (clusters) {
+		first = alloc_chain(image, clusters);
+		if (0 == first || write_sectors(image, cluster_sector(image, first), data, size)) return -1;
+	}
+
+	uint8_t* entry = new_entry(image, parent);
+	if (NULL == entry) return -1;
+	fill_entry(entry, name, ATTR_ARCHIVE, first, size);
+	return 0;
+}
+
+int fat_image_finish(fat_image_t* image) {
+	int err = 0;
+	uint32_t cluster_size = (uint32_t)image->sectors_per_cluster * SECTOR_SIZE;
+
+	// Directories larger than one cluster get the rest of their chain now
+	uint8_t* zero = calloc(1, cluster_size);
+	if (NULL == zero) err = -1;
+	for (size_t i = 0; i < image->dir_count && !err; i++) {
+		fat_image_dir* dir = &image->dirs[i];
+		size_t size = dir->count * ENTRY_SIZE;
+		uint32_t clusters = (size > cluster_size) ? (size + cluster_size - 1) / cluster_size : 1;
+		uint32_t cluster = dir->cluster;
+		if (clusters > 1) {
+			image->fat[cluster] = alloc_chain(image, clusters - 1);
+			if (0 == image->fat[cluster]) err = -1;
+		}
+		for (uint32_t id = 0; id < clusters && !err; id++) {
+			size_t offset = (size_t)id * cluster_size;
+			size_t chunk = (size - offset < cluster_size) ? size - offset : cluster_size;
+			err = write_sectors(image, cluster_sector(image, cluster), zero, cluster_size);
+			if (!err && chunk) err = write_sectors(image, cluster_sector(image, cluster), &dir->entries[offset], chunk);
+			cluster = image->fat[cluster];
+		}
+	}
+	for (size_t i = 0; i < image->dir_count; i++) free(image->dirs[i].entries);
+	free(zero);
+
+	uint8_t sector[SECTOR_SIZE];
+
+	// Master Boot Record with single FAT32 (LBA) partition
+	memset(sector, 0, SECTOR_SIZE);
+	sector[0x1BE + 4] = 0x0C;
+	put32(&sector[0x1BE + 8], image->partition_start);
+	put32(&sector[0x1BE + 12], image->partition_sectors);
+	sector[510] = 0x55;
+	sector[511] = 0xAA;
+	if (!err) err = write_sectors(image, 0, sector, SECTOR_SIZE);
+
+	// Volume Boot Record and its backup copy
+	memset(sector, 0, SECTOR_SIZE);
+	memcpy(&sector[0], "\xEB\x58\x90" "MSWIN4.1", 11);
+	put16(&sector[0x0B], SECTOR_SIZE);
+	sector[0x0D] = image->sectors_per_cluster;
+	put16(&sector[0x0E], image->reserved_sectors);
+	sector[0x10] = NUM_FATS;
+	sector[0x15] = 0xF8;
+	put16(&sector[0x18], 63);
+	put16(&sector[0x1A], 255);
+	put32(&sector[0x1C], image->partition_start);
+	put32(&sector[0x20], image->partition_sectors);
+	put32(&sector[0x24], image->sectors_per_fat);
+	put32(&sector[0x2C], 2);
+	put16(&sector[0x30], 1);
+	put16(&sector[0x32], 6);
+	sector[0x40] = 0x80;
+	sector[0x42] = 0x29;
+	memcpy(&sector[0x47], "NO NAME    FAT32   ", 19);
+	sector[510] = 0x55;
+	sector[511] = 0xAA;
+	if (!err) err = write_sectors(image, image->partition_start, sector, SECTOR_SIZE);
+	if (!err) err = write_sectors(image, image->partition_start + 6, sector, SECTOR_SIZE);
+
+	// FSInfo sector and its backup copy
+	memset(sector, 0, SECTOR_SIZE);
+	put32(&sector[0], 0x41615252);
+	put32(&sector[484], 0x61417272);
+	put32(&sector[488], image->clusters + 2 - image->next_free);
+	put32(&sector[492], image->next_free);
+	put32(&sector[508], 0xAA550000);
+	if (!err) err = write_sectors(image, image->partition_start + 1, sector, SECTOR_SIZE);
+	if (!err) err = write_sectors(image, image->partition_start + 7, sector, SECTOR_SIZE);
+
+	// All FAT copies
+	for (uint8_t copy = 0; copy < NUM_FATS && !err; copy++) {
+		uint32_t fat_sector = image->partition_start + image->reserved_sectors + copy * image->sectors_per_fat;
+		err = write_sectors(image, fat_sector, image->fat, (size_t)image->sectors_per_fat * SECTOR_SIZE);
+	}
+
+	free(image->fat);
+	free(image->dirs);
+	close(image->fd);
+	return err;
+}
@@ -0,0 +1,48 @@
+/*
+ * fat_image.h
+ *
+ * Created: 17.10.2026 15:02:37
+ * Author : agent
+ */ 
+
+
+#ifndef FAT_IMAGE_H_
+#define FAT_IMAGE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Directory being populated - entries are stored when image is finished */
+typedef struct {
+	uint32_t cluster;
+	uint8_t* entries;
+	size_t count;
+	size_t capacity;
+} fat_image_dir;
+
+typedef struct {
+	int fd;
+	uint32_t partition_start;
+	uint32_t partition_sectors;
+	uint8_t  sectors_per_cluster;
+	uint16_t reserved_sectors;
+	uint32_t sectors_per_fat;
+	uint32_t clusters;
+	uint32_t next_free;
+	uint32_t* fat;
+	fat_image_dir* dirs;
+	size_t dir_count;
+} fat_image_t;
+
+#define FAT_IMAGE_ROOT 0
+
+/* Creates raw image with MBR and single FAT32 partition spanning whole image */
+int fat_image_create(fat_image_t* image, const char* path, const uint32_t size_mb, const uint8_t sectors_per_cluster);
+/* Adds subdirectory - returns its handle to be used as parent or -1 on failure */
+int fat_image_add_dir(fat_image_t* image, const int parent, const char* name);
+/* Adds file with contiguous clusters */
+int fat_image_add_file(fat_image_t* image, const int parent, const char* name, const uint8_t* data, const uint32_t size);
+/* Stores directories and FAT copies and closes image */
+int fat_image_finish(fat_image_t* image);
+
+#endif /* FAT_IMAGE_H_ */
@@ -0,0 +1,604 @@
+/*
+ * slim-fat-bench.c
+ *
+ * Created: 17.10.2026 15:40:12
+ * Author : agent
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Library supplied disk image driver
+#include "image-driver/image_driver.h"
+
+// Library supplied SD card driver and SPI SD card emulator
+#include "sd-driver/sd_driver.h"
+#include "sd-emulator/sd_emulator.h"
+
+// SlimFAT file system driver
+#include "slimfat/slimfat.h"
+
+// Benchmark disk image generator
+#include "fat_image.h"
+
+#ifndef SLIMFAT_STATS
+#error "Benchmark requires SLIMFAT_STATS to be defined"
+#endif
+
+#define MAX_CACHE_SLOTS	64
+#define MAX_ALLOC_MAP	(128UL * 1024UL)
+#define MAX_EXTENTS		255
+#define MAX_DIR_CACHE	255
+
+#define IMAGE_SIZE_MB	256
+#define SEQ_FILE_SIZE	(1024UL * 1024UL)
+#define TEXT_LINES		20000
+#define DEEP_LEVELS		8
+#define WIDE_FILES		2000
+#define LOG_FILES		32
+#define LOG_APPENDS		16
+#define SEEK_COUNT		2000
+#define OPEN_COUNT		200
+#define PUTC_BYTES		(64UL * 1024UL)
+#define RECORD_COUNT	4096
+#define RECORD_PAYLOAD	200
+#define RECORD_SIZE		(6 + RECORD_PAYLOAD + 4)
+#define LOG_RECORD_SIZE	32
+
+static const uint16_t chunk_sizes[] = { 1, 64, 512, 4096, 32768 };
+
+typedef struct {
+	const char* image_path;
+	uint8_t slots;
+	uint8_t sectors_per_cluster;
+	uint8_t write_back;
+	uint8_t multi_sector;
+	uint8_t mapped;
+	uint8_t sd_card;
+	uint8_t spi_block;
+	uint8_t erase;
+	uint32_t alloc_map_size;
+	uint8_t extent_slots;
+	uint8_t fat_slots;
+	uint8_t dir_cache_size;
+	uint8_t private_buffers;
+} bench_config;
+
+typedef struct {
+	fs_stats_t stats;
+	sd_emu_stats_t spi;
+	struct timespec start;
+} bench_probe;
+
+static uint8_t cache_buffer[MAX_CACHE_SLOTS * SECTOR_SIZE];
+static fs_cache_slot cache_slots[MAX_CACHE_SLOTS];
+static uint8_t fat_cache_buffer[MAX_CACHE_SLOTS * SECTOR_SIZE];
+static fs_cache_slot fat_cache_slots[MAX_CACHE_SLOTS];
+static uint8_t data_buffer[SEQ_FILE_SIZE];
+static uint8_t seq_contents[SEQ_FILE_SIZE];
+static uint8_t text_contents[SEQ_FILE_SIZE];
+static uint32_t text_size;
+static uint8_t expected_buffer[SEQ_FILE_SIZE];
+static uint8_t verify_buffer[32768];
+static uint8_t verify_failed;
+static uint8_t alloc_map[MAX_ALLOC_MAP];
+static fs_extent_t extents[MAX_EXTENTS];
+static uint8_t extent_slots;
+static fs_dir_cache_entry dir_cache[MAX_DIR_CACHE];
+static uint8_t file_buffers[2][SECTOR_SIZE];
+static uint8_t private_buffers;
+
+/* Deterministic pseudo random numbers - results must not depend on libc */
+static uint32_t bench_random(void) {
+	static uint32_t state = 0x12345678;
+	state = state * 1664525UL + 1013904223UL;
+	return state >> 8;
+}
+
+static void probe_start(bench_probe* probe) {
+	fs_reset_stats();
+	sd_emu_reset_stats();
+	clock_gettime(CLOCK_MONOTONIC, &probe->start);
+}
+
+static void probe_report(bench_probe* probe, const char* workload, const uint32_t param, const uint32_t ops, const uint32_t bytes) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	fs_get_stats(&probe->stats);
+	sd_emu_get_stats(&probe->spi);
+
+	double wall_us = (end.tv_sec - probe->start.tv_sec) * 1e6 + (end.tv_nsec - probe->start.tv_nsec) / 1e3;
+	const fs_stats_t* s = &probe->stats;
+	const sd_emu_stats_t* spi = &probe->spi;
+	uint32_t spi_sectors = spi->sectors_read + spi->sectors_written;
+	printf("%s,%lu,%lu,%lu,%.1f,%.3f,%lu,%lu,%.4f,%.4f,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%.1f\n",
+		workload, (unsigned long)param, (unsigned long)ops, (unsigned long)bytes,
+		wall_us, ops ? wall_us / ops : 0.0,
+		(unsigned long)s->sector_reads, (unsigned long)s->sector_writes,
+		ops ? (double)s->sector_reads / ops : 0.0, ops ? (double)s->sector_writes / ops : 0.0,
+		(unsigned long)s->buffer_hits, (unsigned long)s->redundant_writes, (unsigned long)s->fat_lookups,
+		(unsigned long)s->alloc_scanned_sectors, (unsigned long)s->dir_scanned_sectors,
+		(unsigned long)spi->bytes_clocked, (unsigned long)spi->transfer_calls, (unsigned long)spi->wait_bytes, (unsigned long)spi->busy_bytes,
+		spi_sectors ? (double)spi->bytes_clocked / spi_sectors : 0.0);
+}
+
+static int generate_image(const bench_config* config) {
+	fat_image_t image;
+	int err = fat_image_create(&image, config->image_path, IMAGE_SIZE_MB, config->sectors_per_cluster);
+
+	// Sequential and random access data
+	for (uint32_t i = 0; i < SEQ_FILE_SIZE; i++) seq_contents[i] = (uint8_t)bench_random();
+	if (!err) err = fat_image_add_file(&image, FAT_IMAGE_ROOT, "seq.bin", seq_contents, SEQ_FILE_SIZE);
+	memcpy(data_buffer, seq_contents, SEQ_FILE_SIZE);
+
+	// CSV like text with CRLF line endings
+	text_size = 0;
+	for (uint32_t line = 0; line < TEXT_LINES && text_size + 64 < SEQ_FILE_SIZE; line++) {
+		text_size += sprintf((char*)&text_contents[text_size], "%lu,%lu,%lu,sample\r\n",
+			(unsigned long)line, (unsigned long)(bench_random() % 100000), (unsigned long)(bench_random() % 1000));
+	}
+	if (!err) err = fat_image_add_file(&image, FAT_IMAGE_ROOT, "text.csv", text_contents, text_size);
+
+	// Deep directory path d0/d1/.../deep.txt
+	int dir = FAT_IMAGE_ROOT;
+	for (int level = 0; level < DEEP_LEVELS && !err; level++) {
+		char name[8];
+		sprintf(name, "d%d", level);
+		dir = fat_image_add_dir(&image, dir, name);
+		if (dir < 0) err = -1;
+	}
+	if (!err) err = fat_image_add_file(&image, dir, "deep.txt", (const uint8_t*)"deep\r\n", 6);
+
+	// Directory with thousands of entries
+	dir = fat_image_add_dir(&image, FAT_IMAGE_ROOT, "wide");
+	if (dir < 0) err = -1;
+	for (int file = 0; file < WIDE_FILES && !err; file++) {
+		char name[16];
+		sprintf(name, "f%04d.txt", file);
+		err = fat_image_add_file(&image, dir, name, (const uint8_t*)"wide\r\n", 6);
+	}
+
+	// Log files for small appends
+	dir = fat_image_add_dir(&image, FAT_IMAGE_ROOT, "logs");
+	if (dir < 0) err = -1;
+	for (int file = 0; file < LOG_FILES && !err; file++) {
+		char name[16];
+		sprintf(name, "log%02d.csv", file);
+		err = fat_image_add_file(&image, dir, name, (const uint8_t*)"time,value\r\n", 12);
+	}
+
+	if (fat_image_finish(&image)) err = -1;
+	return err;
+}
+
+/* Written files are read back after the workload is reported - broken writes must not pass as fast ones */
+static void verify_file(fs_partition_t* partition, const char* path, const uint8_t* expected, const uint32_t size) {
+	fs_file_t file = GET_FILE_HANDLE(*partition);
+	uint8_t match = 0;
+
+	if (FS_SUCCESS == fs_fopen(&file, path, READ)) {
+		match = (file.entry.file_size == size);
+		uint32_t checked = 0;
+		while (match && checked < size) {
+			uint32_t read = fs_fread(&file, verify_buffer, sizeof(verify_buffer));
+			match = read && !memcmp(verify_buffer, &expected[checked], read);
+			checked += read;
+		}
+		fs_fclose(&file);
+	}
+	if (!match) {
+		fprintf(stderr, "%s: contents differ from written data\n", path);
+		verify_failed = 1;
+	}
+}
+
+/* Read workloads are checked against the contents the image was generated with */
+static void check_read(const char* workload, const uint32_t param, const uint8_t match) {
+	if (!match) {
+		fprintf(stderr, "%s %lu: read data differ from image contents\n", workload, (unsigned long)param);
+		verify_failed = 1;
+	}
+}
+
+static void bench_fread(fs_partition_t* partition, const uint16_t chunk) {
+	bench_probe probe;
+	fs_file_t file = GET_EXTENT_FILE_HANDLE(*partition, extents, extent_slots);
+	uint32_t ops = 0, bytes = 0;
+
+	probe_start(&probe);
+	if (FS_SUCCESS == fs_fopen(&file, "seq.bin", READ)) {
+		uint16_t read = 0;
+		do {
+			read = fs_fread(&file, &expected_buffer[bytes], (bytes + chunk <= SEQ_FILE_SIZE) ? chunk : SEQ_FILE_SIZE - bytes);
+			bytes += read;
+			ops++;
+		} while (read);
+		fs_fclose(&file);
+	}
+	probe_report(&probe, "fread", chunk, ops, bytes);
+	check_read("fread", chunk, SEQ_FILE_SIZE == bytes && !memcmp(expected_buffer, seq_contents, SEQ_FILE_SIZE));
+}
+
+static void bench_fwrite(fs_partition_t* partition, const uint16_t chunk, const uint8_t preallocate) {
+	bench_probe probe;
+	fs_file_t file = GET_EXTENT_FILE_HANDLE(*partition, extents, extent_slots);
+	uint32_t ops = 0, bytes = 0;
+
+	probe_start(&probe);
+	if (FS_SUCCESS == fs_fopen(&file, "write.bin", WRITE)) {
+		if (preallocate) fs_fallocate(&file, SEQ_FILE_SIZE);
+		while (bytes < SEQ_FILE_SIZE) {
+			uint16_t written = fs_fwrite(&file, &data_buffer[bytes], chunk);
+			if (!written) break;
+			bytes += written;
+			ops++;
+		}
+		fs_fclose(&file);
+	}
+	probe_report(&probe, preallocate ? "fwrite_prealloc" : "fwrite", chunk, ops, bytes);
+	verify_file(partition, "write.bin", data_buffer, SEQ_FILE_SIZE);
+}
+
+static void bench_fputc(fs_partition_t* partition) {
+	bench_probe probe;
+	fs_file_t file = GET_EXTENT_FILE_HANDLE(*partition, extents, extent_slots);
+	uint32_t ops = 0;
+
+	probe_start(&probe);
+	if (FS_SUCCESS == fs_fopen(&file, "putc.txt", WRITE)) {
+		for (; ops < PUTC_BYTES; ops++) {
+			if (FS_SUCCESS != fs_fputc(&file, 'a' + (ops % 26))) break;
+		}
+		fs_fclose(&file);
+	}
+	probe_report(&probe, "fputc", 1, ops, ops);
+	for (uint32_t i = 0; i < PUTC_BYTES; i++) expected_buffer[i] = 'a' + (i % 26);
+	verify_file(partition, "putc.txt", expected_buffer, PUTC_BYTES);
+}
+
+static void bench_interleave(fs_partition_t* partition) {
+	bench_probe probe;
+	fs_file_t log_file = GET_FILE_HANDLE(*partition);
+	fs_file_t text_file = GET_FILE_HANDLE(*partition);
+	if (private_buffers) {
+		log_file.buffer = file_buffers[0];
+		text_file.buffer = file_buffers[1];
+	}
+	uint32_t ops = 0;
+
+	probe_start(&probe);
+	if (FS_SUCCESS == fs_fopen(&log_file, "putc.txt", WRITE)) {
+		if (FS_SUCCESS == fs_fopen(&text_file, "text.csv", READ)) {
+			// Byte written to one file, byte read from the other
+			for (; ops < PUTC_BYTES && !fs_feof(&text_file); ops++) {
+				if (FS_SUCCESS != fs_fputc(&log_file, fs_fgetc(&text_file))) break;
+			}
+			fs_fclose(&text_file);
+		}
+		fs_fclose(&log_file);
+	}
+	probe_report(&probe, "interleave", 1, ops, ops);
+	uint32_t copied = 0;
+	if (FS_SUCCESS == fs_fopen(&text_file, "text.csv", READ)) {
+		copied = fs_fread(&text_file, expected_buffer, PUTC_BYTES);
+		fs_fclose(&text_file);
+	}
+	verify_file(partition, "putc.txt", expected_buffer, (copied < PUTC_BYTES) ? copied : PUTC_BYTES);
+}
+
+static void bench_records(fs_partition_t* partition, const uint8_t vectored) {
+	bench_probe probe;
+	fs_file_t file = GET_EXTENT_FILE_HANDLE(*partition, extents, extent_slots);
+	uint32_t ops = 0, bytes = 0;
+	uint8_t header[6] = { 'R', 'E', 'C' };
+	uint8_t crc[4] = { 0 };
+	static uint8_t record_crc[RECORD_COUNT];
+
+	probe_start(&probe);
+	if (FS_SUCCESS == fs_fopen(&file, "records.bin", WRITE)) {
+		// Header, payload and CRC assembled from separate buffers
+		for (; ops < RECORD_COUNT; ops++) {
+			header[3] = (uint8_t)ops;
+			crc[0] = (uint8_t)bench_random();
+			record_crc[ops] = crc[0];
+			fs_const_iovec_t record[3] = {
+				{ .base = header, .length = sizeof(header) },
+				{ .base = &data_buffer[ops % 1024], .length = RECORD_PAYLOAD },
+				{ .base = crc, .length = sizeof(crc) }
+			};
+			uint32_t size = RECORD_SIZE;
+			uint32_t written = 0;
+			if (vectored) written = fs_fwritev(&file, record, 3);
+			else for (uint8_t i = 0; i < 3; i++) written += fs_fwrite(&file, record[i].base, record[i].length);
+			if (written != size) break;
+			bytes += written;
+		}
+		fs_fclose(&file);
+	}
+	probe_report(&probe, vectored ? "record_fwritev" : "record_fwrite", 3, ops, bytes);
+	for (uint32_t record = 0; record < RECORD_COUNT; record++) {
+		uint8_t* expected = &expected_buffer[record * RECORD_SIZE];
+		memcpy(expected, header, sizeof(header));
+		expected[3] = (uint8_t)record;
+		memcpy(&expected[sizeof(header)], &data_buffer[record % 1024], RECORD_PAYLOAD);
+		memset(&expected[sizeof(header) + RECORD_PAYLOAD], 0, sizeof(crc));
+		expected[sizeof(header) + RECORD_PAYLOAD] = record_crc[record];
+	}
+	verify_file(partition, "records.bin", expected_buffer, RECORD_COUNT * RECORD_SIZE);
+}
+
+static void bench_fgets(fs_partition_t* partition) {
+	bench_probe probe;
+	fs_file_t file = GET_EXTENT_FILE_HANDLE(*partition, extents, extent_slots);
+	uint32_t ops = 0, bytes = 0;
+	uint8_t line[128];
+	uint8_t match = 1;
+
+	probe_start(&probe);
+	if (FS_SUCCESS == fs_fopen(&file, "text.csv", READ)) {
+		while (fs_fgets(&file, line, sizeof(line))) {
+			// Line is returned with its CRLF and without terminator
+			uint32_t length = fs_ftell(&file) - bytes;
+			match &= (length >= 2 && !memcmp(line, &text_contents[bytes], length) && '\n' == line[length - 1]);
+			bytes += length;
+			ops++;
+		}
+		fs_fclose(&file);
+	}
+	probe_report(&probe, "fgets", sizeof(line), ops, bytes);
+	check_read("fgets", sizeof(line), match && text_size == bytes);
+}
+
+static void bench_fseek(fs_partition_t* partition) {
+	bench_probe probe;
+	fs_file_t file = GET_EXTENT_FILE_HANDLE(*partition, extents, extent_slots);
+	uint32_t ops = 0;
+	uint8_t match = 1;
+
+	probe_start(&probe);
+	if (FS_SUCCESS == fs_fopen(&file, "seq.bin", READ)) {
+		for (; ops < SEEK_COUNT; ops++) {
+			uint32_t position = bench_random() % SEQ_FILE_SIZE;
+			if (FS_SUCCESS != fs_fseek(&file, position, FS_SEEK_SET)) break;
+			match &= (seq_contents[position] == fs_fgetc(&file));
+		}
+		fs_fclose(&file);
+	}
+	probe_report(&probe, "fseek", SEEK_COUNT, ops, ops);
+	check_read("fseek", SEEK_COUNT, match && SEEK_COUNT == ops);
+}
+
+static void bench_fopen(fs_partition_t* partition, const char* workload, const char* path) {
+	bench_probe probe;
+	uint32_t ops = 0;
+
+	probe_start(&probe);
+	for (uint32_t i = 0; i < OPEN_COUNT; i++) {
+		fs_file_t file = GET_EXTENT_FILE_HANDLE(*partition, extents, extent_slots);
+		if (FS_SUCCESS == fs_fopen(&file, path, READ)) {
+			fs_fclose(&file);
+			ops++;
+		}
+	}
+	probe_report(&probe, workload, OPEN_COUNT, ops, 0);
+}
+
+static void bench_readdir(fs_partition_t* partition) {
+	bench_probe probe;
+	uint32_t ops = 0;
+	uint32_t bytes = 0;
+
+	probe_start(&probe);
+	fs_dir_t dir = GET_DIR_HANDLE(*partition);
+	if (FS_SUCCESS == fs_opendir(&dir, "wide")) {
+		fs_dirent_t dirent;
+		while (FS_SUCCESS == fs_readdir(&dir, &dirent)) {
+			bytes += dirent.entry.file_size;
+			ops++;
+		}
+		fs_closedir(&dir);
+	}
+	probe_report(&probe, "readdir_wide", WIDE_FILES, ops, bytes);
+}
+
+static void bench_append(fs_partition_t* partition) {
+	bench_probe probe;
+	uint32_t ops = 0, bytes = 0;
+	static char log_expected[LOG_FILES][12 + LOG_APPENDS * LOG_RECORD_SIZE];
+	for (uint32_t log = 0; log < LOG_FILES; log++) strcpy(log_expected[log], "time,value\r\n");
+
+	probe_start(&probe);
+	for (uint32_t round = 0; round < LOG_APPENDS; round++) {
+		for (uint32_t log = 0; log < LOG_FILES; log++) {
+			char path[24];
+			char record[LOG_RECORD_SIZE];
+			fs_file_t file = GET_EXTENT_FILE_HANDLE(*partition, extents, extent_slots);
+			sprintf(path, "logs/log%02lu.csv", (unsigned long)log);
+			sprintf(record, "%lu,%lu\r\n", (unsigned long)round, (unsigned long)(bench_random() % 100000));
+			if (FS_SUCCESS == fs_fopen(&file, path, APPEND)) {
+				fs_fputs(&file, (const uint8_t*)record);
+				fs_fclose(&file);
+				strcat(log_expected[log], record);
+				bytes += strlen(record);
+				ops++;
+			}
+		}
+	}
+	probe_report(&probe, "append", LOG_FILES, ops, bytes);
+	for (uint32_t log = 0; log < LOG_FILES; log++) {
+		char path[24];
+		sprintf(path, "logs/log%02lu.csv", (unsigned long)log);
+		verify_file(partition, path, (const uint8_t*)log_expected[log], strlen(log_expected[log]));
+	}
+}
+
+/* SD card driver accessed through fs_storage_device function pointers */
+static uint8_t sd_read(void* sd, const uint32_t sector, uint8_t* buffer) {
+	return sd_card_read(sd, sector, buffer);
+}
+
+static uint8_t sd_write(void* sd, const uint32_t sector, const uint8_t* buffer) {
+	return sd_card_write(sd, sector, buffer);
+}
+
+static uint8_t sd_read_multiple(void* sd, const uint32_t sector, const uint16_t count, uint8_t* buffer) {
+	return sd_card_read_multiple(sd, sector, count, buffer);
+}
+
+static uint8_t sd_write_multiple(void* sd, const uint32_t sector, const uint16_t count, const uint8_t* buffer) {
+	return sd_card_write_multiple(sd, sector, count, buffer);
+}
+
+static uint8_t sd_erase(void* sd, const uint32_t sector, const uint32_t count) {
+	return sd_card_erase(sd, sector, count);
+}
+
+/* Option values are range checked before they are narrowed to configuration fields */
+static int parse_value(const char* text, const long min, const long max, long* value) {
+	char* end = NULL;
+	*value = strtol(text, &end, 10);
+	return (end == text || '\0' != *end || *value < min || *value > max) ? -1 : 0;
+}
+
+static int parse_args(int argc, char* argv[], bench_config* config) {
+	config->slots = 1;
+	config->sectors_per_cluster = 8;
+	config->write_back = 0;
+	config->multi_sector = 0;
+	config->mapped = 0;
+	config->sd_card = 0;
+	config->spi_block = 0;
+	config->erase = 0;
+	config->alloc_map_size = 0;
+	config->extent_slots = 0;
+	config->fat_slots = 0;
+	config->dir_cache_size = 0;
+	config->private_buffers = 0;
+	config->image_path = NULL;
+
+	long value = 0;
+	for (int i = 1; i < argc; i++) {
+		if (0 == strcmp(argv[i], "-s") && i + 1 < argc) {
+			if (parse_value(argv[++i], 1, MAX_CACHE_SLOTS, &value)) return -1;
+			config->slots = (uint8_t)value;
+		}
+		else if (0 == strcmp(argv[i], "-c") && i + 1 < argc) {
+			if (parse_value(argv[++i], 1, 128, &value)) return -1;
+			config->sectors_per_cluster = (uint8_t)value;
+		}
+		else if (0 == strcmp(argv[i], "-w")) config->write_back = 1;
+		else if (0 == strcmp(argv[i], "-m")) config->multi_sector = 1;
+		else if (0 == strcmp(argv[i], "--mmap")) config->mapped = 1;
+		else if (0 == strcmp(argv[i], "--sd")) config->sd_card = 1;
+		else if (0 == strcmp(argv[i], "-b")) config->spi_block = 1;
+		else if (0 == strcmp(argv[i], "-t")) config->erase = 1;
+		else if (0 == strcmp(argv[i], "-p")) config->private_buffers = 1;
+		else if (0 == strcmp(argv[i], "-a") && i + 1 < argc) {
+			if (parse_value(argv[++i], 0, MAX_ALLOC_MAP, &value)) return -1;
+			config->alloc_map_size = (uint32_t)value;
+		}
+		else if (0 == strcmp(argv[i], "-e") && i + 1 < argc) {
+			if (parse_value(argv[++i], 0, MAX_EXTENTS, &value)) return -1;
+			config->extent_slots = (uint8_t)value;
+		}
+		else if (0 == strcmp(argv[i], "-f") && i + 1 < argc) {
+			if (parse_value(argv[++i], 0, MAX_CACHE_SLOTS, &value)) return -1;
+			config->fat_slots = (uint8_t)value;
+		}
+		else if (0 == strcmp(argv[i], "-d") && i + 1 < argc) {
+			if (parse_value(argv[++i], 0, MAX_DIR_CACHE, &value)) return -1;
+			config->dir_cache_size = (uint8_t)value;
+		}
+		else if ('-' != argv[i][0]) config->image_path = argv[i];
+		else return -1;
+	}
+	if (config->mapped && config->sd_card) return -1;
+	return (NULL == config->image_path) ? -1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+	bench_config config;
+	if (parse_args(argc, argv, &config)) {
+		fprintf(stderr, "usage: %s [-s slots] [-c sectors-per-cluster] [-w] [-m] [-a alloc-map-bytes] [-e extents] [-f fat-slots] [-d dir-entries] [-t] [-p] [--mmap | --sd [-b]] <image>\n", argv[0]);
+		fprintf(stderr, "  -w  write-back cache policy\n  -m  multi-sector transfers\n  --mmap  memory mapped image\n");
+		fprintf(stderr, "  -a  RAM for allocation bitmap - bit per cluster or per FAT sector, whichever fits\n");
+		fprintf(stderr, "  -e  cached cluster runs per file handle\n  -f  separate FAT sector cache slots\n  -d  cached directory entries\n");
+		fprintf(stderr, "  -t  erase hints for freed clusters - hole punching or SD card erase\n");
+		fprintf(stderr, "  -p  private sector buffers of interleaved file handles\n");
+		fprintf(stderr, "  --sd  image accessed by SD card driver through emulated SPI card\n  -b  SPI block transfers\n");
+		return 1;
+	}
+	if (generate_image(&config)) {
+		fprintf(stderr, "cannot generate image %s\n", config.image_path);
+		return 1;
+	}
+
+	image_disk_t image = GET_IMAGE_HANDLE();
+	fs_storage_device storage_dev = GET_CACHED_DEV_HANDLE(cache_buffer, cache_slots, config.slots, &image, image_read, image_write);
+	if (config.mapped) {
+		fs_storage_device mapped_dev = GET_MAPPED_DEV_HANDLE(&image, image_map_sector, image_sync);
+		storage_dev = mapped_dev;
+	}
+	sd_card_t sd_card = GET_SD_HANDLE(sd_emu_transfer_byte, sd_emu_chip_select);
+	if (config.spi_block) {
+		sd_card.spi_transfer_block = sd_emu_transfer_block;
+		sd_card.spi_receive_block = sd_emu_receive_block;
+	}
+	if (config.sd_card) {
+		fs_storage_device sd_dev = GET_CACHED_DEV_HANDLE(cache_buffer, cache_slots, config.slots, &sd_card, sd_read, sd_write);
+		storage_dev = sd_dev;
+	}
+	if (config.write_back) storage_dev.policy = FS_WRITE_BACK;
+	if (config.multi_sector) {
+		storage_dev.read_sectors = config.sd_card ? sd_read_multiple : image_read_multiple;
+		storage_dev.write_sectors = config.sd_card ? sd_write_multiple : image_write_multiple;
+	}
+	if (config.erase) storage_dev.erase_sectors = config.sd_card ? sd_erase : image_erase;
+	fs_partition_t partition = GET_ALLOC_MAP_PART_HANDLE(storage_dev, alloc_map, config.alloc_map_size);
+	extent_slots = config.extent_slots;
+	private_buffers = config.private_buffers;
+	partition.fat_buffer = fat_cache_buffer;
+	partition.fat_slots = fat_cache_slots;
+	partition.fat_slot_count = config.fat_slots;
+	partition.dir_cache = dir_cache;
+	partition.dir_cache_size = config.dir_cache_size;
+
+	uint8_t err = 0;
+	if (config.sd_card) {
+		sd_emu_config sd_config = GET_SD_EMU_CONFIG();
+		err = (SD_EMU_SUCCESS != sd_emu_open(config.image_path, &sd_config)) || (SD_SUCCESS != sd_card_init(&sd_card));
+	}
+	else {
+		err = IMAGE_SUCCESS != (config.mapped ? image_map(&image, config.image_path) : image_open(&image, config.image_path));
+	}
+	if (err || FS_SUCCESS != fs_mount(&partition, 0)) {
+		fprintf(stderr, "cannot mount image %s\n", config.image_path);
+		return 1;
+	}
+
+	printf("workload,param,ops,bytes,wall_us,us_per_op,sector_reads,sector_writes,reads_per_op,writes_per_op,"
+		"buffer_hits,redundant_writes,fat_lookups,alloc_scanned_sectors,dir_scanned_sectors,"
+		"spi_bytes,spi_calls,spi_wait_bytes,spi_busy_bytes,spi_bytes_per_sector\n");
+	for (size_t i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); i++) bench_fread(&partition, chunk_sizes[i]);
+	for (size_t i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); i++) bench_fwrite(&partition, chunk_sizes[i], 0);
+	for (size_t i = 2; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); i++) bench_fwrite(&partition, chunk_sizes[i], 1);
+	bench_fputc(&partition);
+	bench_interleave(&partition);
+	bench_records(&partition, 0);
+	bench_records(&partition, 1);
+	bench_fgets(&partition);
+	bench_fseek(&partition);
+	bench_fopen(&partition, "fopen_deep", "d0/d1/d2/d3/d4/d5/d6/d7/deep.txt");
+	bench_fopen(&partition, "fopen_wide", "wide/f1999.txt");
+	bench_readdir(&partition);
+	bench_append(&partition);
+
+	fs_umount(&partition);
+	image_close(&image);
+	sd_emu_close();
+	return verify_failed;
+}
@@ -0,0 +1,84 @@
+/*
+ * slim-fat-host.c
+ *
+ * Created: 17.10.2026 10:41:17
+ * Author : agent
+ */ 
+
+#include <stdio.h>
+#include <string.h>
+
+// Library supplied disk image driver
+#include "image-driver/image_driver.h"
+
+// SlimFAT file system driver
+#include "slimfat/slimfat.h"
+
+#define CACHE_SLOTS 4
+
+// Device cache
+uint8_t buffer[CACHE_SLOTS * SECTOR_SIZE] = { 0 };
+fs_cache_slot slots[CACHE_SLOTS] = { 0 };
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		printf("usage: %s [--mmap] <fat32-image>\n", argv[0]);
+		return 1;
+	}
+	uint8_t mapped = (argc > 2 && 0 == strcmp(argv[1], "--mmap"));
+	const char* path = argv[argc - 1];
+	
+	// Create handle for raw disk image file
+	image_disk_t image = GET_IMAGE_HANDLE();
+	
+	// Create handle for generic storage device with sector cache
+	fs_storage_device storage_dev = GET_CACHED_DEV_HANDLE(buffer, slots, CACHE_SLOTS, &image, image_read, image_write);
+	storage_dev.read_sectors = image_read_multiple;
+	storage_dev.write_sectors = image_write_multiple;
+	
+	// Or access sectors in place when image is mapped into memory
+	fs_storage_device mapped_dev = GET_MAPPED_DEV_HANDLE(&image, image_map_sector, image_sync);
+	
+	// Create handle for partition to be mounted
+	fs_partition_t partition = GET_PART_HANDLE(storage_dev);
+	if (mapped) partition.device = &mapped_dev;
+	
+	// Open disk image
+	image_err image_status = mapped ? image_map(&image, path) : image_open(&image, path);
+	if (IMAGE_SUCCESS != image_status) {
+		printf("cannot open image %s\n", path);
+		return 1;
+	}
+	
+	// Mount selected partition (0 - 3)
+	fs_error err = fs_mount(&partition, 0);
+	if (FS_SUCCESS == err) {
+		uint8_t line_buff[100] = { 0 };
+		
+		/* Read existing files on mounted partition */
+		fs_file_t read_file = GET_FILE_HANDLE(partition);
+		if (FS_SUCCESS == fs_fopen(&read_file, "read.txt", READ)) {
+			if (fs_fgets(&read_file, line_buff, sizeof(line_buff) - 1)) {
+				printf("read.txt: %s", line_buff);
+			}
+			fs_fclose(&read_file);
+		}
+		
+		/* Write existing files or create new on mounted partition */
+		fs_file_t write_file = GET_FILE_HANDLE(partition);
+		if (FS_SUCCESS == fs_fopen(&write_file, "write.txt", WRITE)) {
+			fs_fputs(&write_file, "Hello, world!\r\n");
+			fs_fclose(&write_file);
+			printf("write.txt: %lu bytes written\n", (unsigned long)write_file.entry.file_size);
+		}
+		
+		fs_umount(&partition);
+		printf("cache hits: %lu, misses: %lu\n", (unsigned long)partition.device->hits, (unsigned long)partition.device->misses);
+	}
+	else {
+		printf("cannot mount partition (error %d)\n", err);
+	}
+	
+	image_close(&image);
+	return (FS_SUCCESS == err) ? 0 : 1;
+}
@@ -28,6 +28,10 @@ int main(void) {
 	// Create handle for generic storage device with sector buffer
 	fs_storage_device storage_dev = GET_DEV_HANDLE(buffer, &sd_card, sd_card_read, sd_card_write);
 	
+	// Transfer whole clusters with multi-block commands
+	storage_dev.read_sectors = sd_card_read_multiple;
+	storage_dev.write_sectors = sd_card_write_multiple;
+	
 	// Create handle for partition to be mounted
 	fs_partition_t partition = GET_PART_HANDLE(storage_dev);
 	
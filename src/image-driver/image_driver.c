@@ -0,0 +1,127 @@
+#define _GNU_SOURCE	// fallocate hole punching
+#include "image_driver.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+uint8_t image_transfer_done(const ssize_t transferred, const uint16_t count) {
+	return (transferred == (ssize_t)count * SECTOR_SIZE);
+}
+
+image_err image_open(image_disk_t* image, const char* path) {
+	image_err err = IMAGE_SUCCESS;
+
+	image->fd = open(path, O_RDWR);
+	if (image->fd < 0) {
+		err = IMAGE_OPEN_FAIL;
+	}
+
+	return err;
+}
+
+image_err image_map(image_disk_t* image, const char* path) {
+	image_err err = IMAGE_SUCCESS;
+
+	struct stat image_stat;
+	err = image_open(image, path);
+	if (IMAGE_SUCCESS == err) {
+		if (0 == fstat(image->fd, &image_stat)) {
+			image->map_size = image_stat.st_size;
+			image->map = mmap(NULL, image->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, image->fd, 0);
+		}
+		if (NULL == image->map || MAP_FAILED == image->map) {
+			image->map = NULL;
+			image_close(image);
+			err = IMAGE_MAP_FAIL;
+		}
+	}
+
+	return err;
+}
+
+void image_close(image_disk_t* image) {
+	if (image->map) {
+		msync(image->map, image->map_size, MS_SYNC);
+		munmap(image->map, image->map_size);
+		image->map = NULL;
+	}
+	if (image->fd >= 0) {
+		fsync(image->fd);
+		close(image->fd);
+		image->fd = -1;
+	}
+}
+
+uint8_t image_read(void* image, const uint32_t sector, uint8_t* buffer) {
+	return image_read_multiple(image, sector, 1, buffer);
+}
+
+uint8_t image_write(void* image, const uint32_t sector, const uint8_t* buffer) {
+	return image_write_multiple(image, sector, 1, buffer);
+}
+
+uint8_t image_read_multiple(void* image, const uint32_t sector, const uint16_t count, uint8_t* buffer) {
+	image_err err = IMAGE_SUCCESS;
+
+	image_disk_t* disk = (image_disk_t*)image;
+	ssize_t transferred = pread(disk->fd, buffer, (size_t)count * SECTOR_SIZE, (off_t)sector * SECTOR_SIZE);
+	if (!image_transfer_done(transferred, count)) {
+		err = IMAGE_READ_FAIL;
+	}
+
+	return err;
+}
+
+uint8_t image_write_multiple(void* image, const uint32_t sector, const uint16_t count, const uint8_t* buffer) {
+	image_err err = IMAGE_SUCCESS;
+
+	image_disk_t* disk = (image_disk_t*)image;
+	ssize_t transferred = pwrite(disk->fd, buffer, (size_t)count * SECTOR_SIZE, (off_t)sector * SECTOR_SIZE);
+	if (!image_transfer_done(transferred, count)) {
+		err = IMAGE_WRITE_FAIL;
+	}
+
+	return err;
+}
+
+uint8_t* image_map_sector(void* image, const uint32_t sector) {
+	image_disk_t* disk = (image_disk_t*)image;
+	uint8_t* mapped = NULL;
+
+	if (((size_t)sector + 1) * SECTOR_SIZE <= disk->map_size) {
+		mapped = &disk->map[(size_t)sector * SECTOR_SIZE];
+	}
+
+	return mapped;
+}
+
+uint8_t image_sync(void* image, const uint32_t sector, const uint32_t count) {
+	image_err err = IMAGE_SUCCESS;
+
+	image_disk_t* disk = (image_disk_t*)image;
+	// msync requires page aligned address
+	size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+	size_t start = ((size_t)sector * SECTOR_SIZE) & ~(page_size - 1);
+	size_t end = ((size_t)sector + count) * SECTOR_SIZE;
+	if (end > disk->map_size) end = disk->map_size;
+	if (start < end && msync(&disk->map[start], end - start, MS_SYNC)) {
+		err = IMAGE_WRITE_FAIL;
+	}
+
+	return err;
+}
+
+uint8_t image_erase(void* image, const uint32_t sector, const uint32_t count) {
+	image_err err = IMAGE_SUCCESS;
+
+	image_disk_t* disk = (image_disk_t*)image;
+	// Punched range reads back as zeros, also through memory mapping
+	if (fallocate(disk->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)sector * SECTOR_SIZE, (off_t)count * SECTOR_SIZE)) {
+		err = IMAGE_WRITE_FAIL;
+	}
+
+	return err;
+}
@@ -0,0 +1,51 @@
+/*
+ * image_driver.h
+ *
+ * Created: 17.10.2026 10:02:41
+ * Author : agent
+ */ 
+
+
+#ifndef IMAGE_DRIVER_H_
+#define IMAGE_DRIVER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SECTOR_SIZE 512
+
+typedef enum {
+	IMAGE_SUCCESS,
+	IMAGE_OPEN_FAIL,	// When image file does not exist or cannot be opened for read and write
+	IMAGE_MAP_FAIL,		// When image file cannot be mapped into memory
+	IMAGE_READ_FAIL,	// When requested sectors could not be read in full
+	IMAGE_WRITE_FAIL	// When requested sectors could not be written in full
+} image_err;
+
+typedef struct {
+	int fd;
+	/* Memory mapped image - NULL when accessed with pread/pwrite */
+	uint8_t* map;
+	size_t map_size;
+} image_disk_t;
+
+#define GET_IMAGE_HANDLE() {.fd = -1, .map = NULL, .map_size = 0}
+
+image_err	image_open(image_disk_t* image, const char* path);
+image_err	image_map(image_disk_t* image, const char* path);
+void		image_close(image_disk_t* image);
+
+/* Sector access - signatures match fs_storage_device function pointers */
+uint8_t		image_read(void* image, const uint32_t sector, uint8_t* buffer);
+uint8_t		image_write(void* image, const uint32_t sector, const uint8_t* buffer);
+uint8_t		image_read_multiple(void* image, const uint32_t sector, const uint16_t count, uint8_t* buffer);
+uint8_t		image_write_multiple(void* image, const uint32_t sector, const uint16_t count, const uint8_t* buffer);
+
+/* Erase hint - released sectors are punched out of image file */
+uint8_t		image_erase(void* image, const uint32_t sector, const uint32_t count);
+
+/* Mapped access - signatures match fs_storage_device function pointers */
+uint8_t*	image_map_sector(void* image, const uint32_t sector);
+uint8_t		image_sync(void* image, const uint32_t sector, const uint32_t count);
+
+#endif /* IMAGE_DRIVER_H_ */
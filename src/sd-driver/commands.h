@@ -40,5 +40,25 @@
 #define WRITE_BLOCK				0x58
 #define WRITE_BLOCK_CRC			0x00
 
+#define STOP_TRANSMISSION		0x4C
+#define STOP_TRANSMISSION_ARG	0x00000000
+#define STOP_TRANSMISSION_CRC	0x00
+
+#define READ_MULTIPLE_BLOCK		0x52
+#define READ_MULTIPLE_BLOCK_CRC	0x00
+
+#define WRITE_MULTIPLE_BLOCK	0x59
+#define WRITE_MULTIPLE_BLOCK_CRC	0x00
+
+#define ERASE_WR_BLK_START		0x60
+#define ERASE_WR_BLK_START_CRC	0x00
+
+#define ERASE_WR_BLK_END		0x61
+#define ERASE_WR_BLK_END_CRC	0x00
+
+#define ERASE					0x66
+#define ERASE_ARG				0x00000000
+#define ERASE_CRC				0x00
+
 
 #endif /* COMMANDS_H_ */
\ No newline at end of file
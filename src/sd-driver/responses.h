@@ -33,6 +33,8 @@
 #define ACCEPT_VOL_RNG		0b0001
 
 #define BLOCK_START_TOKEN	0xFE
+#define MULTI_START_TOKEN	0xFC
+#define STOP_TRAN_TOKEN		0xFD
 
 #define DATA_RESP_TOKEN		0x0E
 #define DATA_ACCEPTED		0x04
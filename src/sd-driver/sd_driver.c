@@ -1,6 +1,7 @@
 #include "sd_driver.h"
 
 #include <stddef.h>
+#include <string.h>
 #include "commands.h"
 #include "responses.h"
 
@@ -14,15 +15,28 @@ uint8_t sd_card_tranfer_byte(sd_card_t* sd, uint8_t byte){
 	return sd->spi_transfer_byte(byte);
 }
 
+uint8_t sd_card_block_capable(sd_card_t* sd){
+	return (NULL != sd->spi_transfer_block || NULL != sd->spi_receive_block);
+}
+
+void sd_card_transmit(sd_card_t* sd, const uint8_t* tx, const uint16_t len){
+	if(sd->spi_transfer_block) sd->spi_transfer_block(tx, NULL, len);
+	else for(uint16_t i = 0; i < len; i++) sd_card_tranfer_byte(sd, tx[i]);
+}
+
+void sd_card_receive(sd_card_t* sd, uint8_t* rx, const uint16_t len){
+	if(sd->spi_receive_block) sd->spi_receive_block(rx, len);
+	else if(sd->spi_transfer_block) {
+		// Transmitted byte is always sent before its place in buffer is received
+		memset(rx, DUMMY_BYTE, len);
+		sd->spi_transfer_block(rx, rx, len);
+	}
+	else for(uint16_t i = 0; i < len; i++) rx[i] = sd_card_tranfer_byte(sd, DUMMY_BYTE);
+}
+
 void sd_card_send_command(sd_card_t* sd, uint8_t command, uint32_t argument, uint8_t CRC) {
-	sd_card_tranfer_byte(sd, command);
-	
-	sd_card_tranfer_byte(sd, argument>>24);
-	sd_card_tranfer_byte(sd, argument>>16);
-	sd_card_tranfer_byte(sd, argument>>8);
-	sd_card_tranfer_byte(sd, argument);
-	
-	sd_card_tranfer_byte(sd, CRC);
+	uint8_t frame[6] = { command, argument>>24, argument>>16, argument>>8, argument, CRC };
+	sd_card_transmit(sd, frame, sizeof(frame));
 }
 
 uint8_t sd_card_get_resp(sd_card_t* sd, uint8_t exp_bytes, uint8_t* resp_buff){
@@ -110,6 +124,34 @@ inline sd_card_err sd_card_execute_CMD24(sd_card_t* sd, const uint32_t sector){
 	return err;
 }
 
+inline sd_card_err sd_card_execute_CMD18(sd_card_t* sd, const uint32_t sector) {
+	sd_card_err err = SD_SUCCESS;
+	
+	sd_card_send_command(sd, READ_MULTIPLE_BLOCK, sector, READ_MULTIPLE_BLOCK_CRC);
+	uint8_t r1 = sd_card_get_resp(sd, R1_RESP_LEN, NULL);
+	if(!(r1 & R1_RESP_MASK)){
+		if( r1 & ADDRESS_ERROR ) err = SD_READ_ADDR_ERR;
+		else if ( r1 & PARAMETER_ERROR ) err = SD_READ_OUT_RNG;
+	}
+	else err = SD_TIMEOUT;
+	
+	return err;
+}
+
+inline sd_card_err sd_card_execute_CMD25(sd_card_t* sd, const uint32_t sector){
+	sd_card_err err = SD_SUCCESS;
+	
+	sd_card_send_command(sd, WRITE_MULTIPLE_BLOCK, sector, WRITE_MULTIPLE_BLOCK_CRC);
+	uint8_t r1 = sd_card_get_resp(sd, R1_RESP_LEN, NULL);
+	if(!(r1 & R1_RESP_MASK)){
+		if( r1 & ADDRESS_ERROR ) err = SD_WRITE_ADDR_ERR;
+		else if ( r1 & PARAMETER_ERROR ) err = SD_WRITE_OUT_RNG;
+	}
+	else err = SD_TIMEOUT;
+	
+	return err;
+}
+
 inline sd_card_err sd_card_execute_CMD58(sd_card_t* sd, uint8_t* ocr) {
 	sd_card_err err = SD_SUCCESS;
 	
@@ -141,26 +183,71 @@ inline sd_card_err sd_card_execute_ACMD41(sd_card_t* sd){
 	return err;
 }
 
-inline sd_card_err sd_card_await_read(sd_card_t* sd){
-	sd_card_err err = SD_SUCCESS;
+inline uint8_t sd_card_poll_len(sd_card_t* sd){
+	return sd_card_block_capable(sd) ? POLL_BLOCK_LEN : 1;
+}
+
+inline sd_card_err sd_card_poll_read_token(sd_card_t* sd, uint8_t* buffer, uint16_t* received){
+	sd_card_err err = SD_BUSY;
 	
-	uint8_t flag = 1;
-	for (uint8_t timeout = 0; timeout < ACCESS_TIMEOUT && flag; timeout++) {
-		uint8_t resp = sd_card_tranfer_byte(sd, DUMMY_BYTE);
-		if( BLOCK_START_TOKEN == resp ) flag = 0;
+	*received = 0;
+	if(sd_card_block_capable(sd)) {
+		// Bytes following start token within polled block are already sector data
+		uint8_t poll[POLL_BLOCK_LEN];
+		sd_card_receive(sd, poll, POLL_BLOCK_LEN);
+		for (uint8_t i = 0; i < POLL_BLOCK_LEN && SD_BUSY == err; i++) {
+			if( BLOCK_START_TOKEN == poll[i] ) {
+				err = SD_SUCCESS;
+				*received = POLL_BLOCK_LEN - i - 1;
+				memcpy(buffer, &poll[i + 1], *received);
+			}
+		}
 	}
-	if(flag) err = SD_READ_FAIL;
+	else if( BLOCK_START_TOKEN == sd_card_tranfer_byte(sd, DUMMY_BYTE) ) err = SD_SUCCESS;
 	
 	return err;
 }
 
-inline sd_card_err sd_card_await_write(sd_card_t* sd){
+inline sd_card_err sd_card_await_read(sd_card_t* sd, uint8_t* buffer, uint16_t* received){
+	sd_card_err err = SD_BUSY;
+	
+	uint8_t poll_len = sd_card_poll_len(sd);
+	for (uint8_t timeout = 0; timeout < ACCESS_TIMEOUT && SD_BUSY == err; timeout += poll_len) {
+		err = sd_card_poll_read_token(sd, buffer, received);
+	}
+	if(SD_BUSY == err) err = SD_READ_FAIL;
+	
+	return err;
+}
+
+inline void sd_card_await_busy(sd_card_t* sd){
+	// Card holds data line low until internal operation is finished
+	if(sd_card_block_capable(sd)) {
+		// Idle card ignores extra dummy bytes clocked after busy is released
+		uint8_t poll[POLL_BLOCK_LEN];
+		do sd_card_receive(sd, poll, POLL_BLOCK_LEN);
+		while( 0x00 == poll[POLL_BLOCK_LEN - 1]);
+	}
+	else while( 0x00 == sd_card_tranfer_byte(sd, DUMMY_BYTE));
+}
+
+inline sd_card_err sd_card_await_block_write(sd_card_t* sd){
 	sd_card_err err = SD_SUCCESS;
 	
 	uint8_t data_token = sd_card_get_resp(sd, R1_RESP_LEN, NULL);
 	if( DATA_ACCEPTED == (data_token & DATA_RESP_TOKEN) ){
-		// Wait for internal operation to finish
-		while( 0x00 == sd_card_tranfer_byte(sd, DUMMY_BYTE));
+		sd_card_await_busy(sd);
+	}
+	else err = SD_WRITE_FAIL;
+	
+	return err;
+}
+
+inline sd_card_err sd_card_await_write(sd_card_t* sd){
+	sd_card_err err = SD_SUCCESS;
+	
+	err = sd_card_await_block_write(sd);
+	if(SD_SUCCESS == err) {
 		// Verify write
 		err = sd_card_execute_CMD13(sd);
 	}
@@ -168,6 +255,77 @@ inline sd_card_err sd_card_await_write(sd_card_t* sd){
 	return err;
 }
 
+inline sd_card_err sd_card_execute_CMD12(sd_card_t* sd){
+	sd_card_err err = SD_SUCCESS;
+	
+	sd_card_send_command(sd, STOP_TRANSMISSION, STOP_TRANSMISSION_ARG, STOP_TRANSMISSION_CRC);
+	sd_card_tranfer_byte(sd, DUMMY_BYTE);	// discard stuff byte
+	uint8_t r1 = sd_card_get_resp(sd, R1_RESP_LEN, NULL);
+	if(!(r1 & R1_RESP_MASK)) sd_card_await_busy(sd);
+	else err = SD_TIMEOUT;
+	
+	return err;
+}
+
+inline sd_card_err sd_card_execute_CMD32(sd_card_t* sd, const uint32_t sector){
+	sd_card_err err = SD_SUCCESS;
+	
+	sd_card_send_command(sd, ERASE_WR_BLK_START, sector, ERASE_WR_BLK_START_CRC);
+	uint8_t r1 = sd_card_get_resp(sd, R1_RESP_LEN, NULL);
+	if(!(r1 & R1_RESP_MASK)){
+		if( r1 & (ILLIGAL_COMMAND | ERASE_SEQ_ERROR | ADDRESS_ERROR | PARAMETER_ERROR) ) err = SD_ERASE_FAIL;
+	}
+	else err = SD_TIMEOUT;
+	
+	return err;
+}
+
+inline sd_card_err sd_card_execute_CMD33(sd_card_t* sd, const uint32_t sector){
+	sd_card_err err = SD_SUCCESS;
+	
+	sd_card_send_command(sd, ERASE_WR_BLK_END, sector, ERASE_WR_BLK_END_CRC);
+	uint8_t r1 = sd_card_get_resp(sd, R1_RESP_LEN, NULL);
+	if(!(r1 & R1_RESP_MASK)){
+		if( r1 & (ILLIGAL_COMMAND | ERASE_SEQ_ERROR | ADDRESS_ERROR | PARAMETER_ERROR) ) err = SD_ERASE_FAIL;
+	}
+	else err = SD_TIMEOUT;
+	
+	return err;
+}
+
+inline sd_card_err sd_card_execute_CMD38(sd_card_t* sd){
+	sd_card_err err = SD_SUCCESS;
+	
+	sd_card_send_command(sd, ERASE, ERASE_ARG, ERASE_CRC);
+	uint8_t r1 = sd_card_get_resp(sd, R1_RESP_LEN, NULL);
+	if(!(r1 & R1_RESP_MASK)){
+		// Card stays busy until all selected blocks are erased
+		sd_card_await_busy(sd);
+		if( r1 & (ILLIGAL_COMMAND | ERASE_SEQ_ERROR | ERASE_RESET) ) err = SD_ERASE_FAIL;
+	}
+	else err = SD_TIMEOUT;
+	
+	return err;
+}
+
+inline void sd_card_receive_block(sd_card_t* sd, uint8_t* buffer, const uint16_t received){
+	// Get rest of sector data
+	sd_card_receive(sd, &buffer[received], SECTOR_SIZE - received);
+	// Get CRC
+	uint8_t crc[2];
+	sd_card_receive(sd, crc, sizeof(crc));
+}
+
+inline void sd_card_send_block(sd_card_t* sd, uint8_t token, const uint8_t* buffer){
+	// Set start token
+	sd_card_tranfer_byte(sd, token);
+	// Transmit whole sector
+	sd_card_transmit(sd, buffer, SECTOR_SIZE);
+	// Send CRC
+	const uint8_t crc[2] = { DUMMY_BYTE, DUMMY_BYTE };
+	sd_card_transmit(sd, crc, sizeof(crc));
+}
+
 
 
 sd_card_err sd_card_init(sd_card_t* sd) {
@@ -206,8 +364,15 @@ sd_card_err sd_card_init(sd_card_t* sd) {
 	return err;
 }
 
+inline sd_card_err sd_card_finish_async(sd_card_t* sd, sd_card_err err){
+	sd->async_state = SD_ASYNC_IDLE;
+	if(sd->async_done) sd->async_done(sd->async_context, err);
+	return err;
+}
+
 sd_card_err sd_card_read(sd_card_t* sd, const uint32_t sector, uint8_t* buffer) {
 	sd_card_err err = SD_SUCCESS;
+	if(SD_ASYNC_IDLE != sd->async_state) return SD_BUSY;
 	
 	uint32_t sector_to_read = sector;
 	if(sd->type != SD_VER_2_0_HC) sector_to_read <<= 9;
@@ -216,14 +381,10 @@ sd_card_err sd_card_read(sd_card_t* sd, const uint32_t sector, uint8_t* buffer)
 	err = sd_card_execute_CMD17(sd, sector_to_read);
 	if(SD_SUCCESS == err) {
 		// Wait for data start token
-		err = sd_card_await_read(sd);
+		uint16_t received = 0;
+		err = sd_card_await_read(sd, buffer, &received);
 		if(SD_SUCCESS == err) {
-			// Get sector data
-			for(uint16_t count = 0; count < SECTOR_SIZE; count++)
-			buffer[count] = sd_card_tranfer_byte(sd, DUMMY_BYTE);
-			// Get CRC
-			sd_card_tranfer_byte(sd, DUMMY_BYTE);
-			sd_card_tranfer_byte(sd, DUMMY_BYTE);
+			sd_card_receive_block(sd, buffer, received);
 		}
 	}
 	
@@ -233,6 +394,7 @@ sd_card_err sd_card_read(sd_card_t* sd, const uint32_t sector, uint8_t* buffer)
 
 sd_card_err sd_card_write(sd_card_t* sd, const uint32_t sector, const uint8_t* buffer) {
 	sd_card_err err = SD_SUCCESS;
+	if(SD_ASYNC_IDLE != sd->async_state) return SD_BUSY;
 	
 	uint32_t sector_to_write = sector;
 	if(sd->type != SD_VER_2_0_HC) sector_to_write <<= 9;
@@ -240,15 +402,7 @@ sd_card_err sd_card_write(sd_card_t* sd, const uint32_t sector, const uint8_t* b
 	sd_card_set_enable(sd, SD_ENABLE);
 	err = sd_card_execute_CMD24(sd, sector_to_write);
 	if(SD_SUCCESS == err) {
-		// Set start token
-		sd_card_tranfer_byte(sd, BLOCK_START_TOKEN);
-		
-		// Transmit whole sector
-		for(uint16_t count = 0; count < SECTOR_SIZE; count++)
-		sd_card_tranfer_byte(sd, buffer[count]);
-		// Send CRC
-		sd_card_tranfer_byte(sd, DUMMY_BYTE);
-		sd_card_tranfer_byte(sd, DUMMY_BYTE);
+		sd_card_send_block(sd, BLOCK_START_TOKEN, buffer);
 		
 		// validate write operation
 		err = sd_card_await_write(sd);
@@ -257,3 +411,155 @@ sd_card_err sd_card_write(sd_card_t* sd, const uint32_t sector, const uint8_t* b
 	sd_card_set_enable(sd, SD_DISABLE);
 	return err;
 }
+
+sd_card_err sd_card_read_multiple(sd_card_t* sd, const uint32_t sector, const uint16_t count, uint8_t* buffer) {
+	sd_card_err err = SD_SUCCESS;
+	if(SD_ASYNC_IDLE != sd->async_state) return SD_BUSY;
+	
+	uint32_t sector_to_read = sector;
+	if(sd->type != SD_VER_2_0_HC) sector_to_read <<= 9;
+	
+	sd_card_set_enable(sd, SD_ENABLE);
+	err = sd_card_execute_CMD18(sd, sector_to_read);
+	if(SD_SUCCESS == err) {
+		for(uint16_t block = 0; block < count && SD_SUCCESS == err; block++) {
+			// Wait for data start token of each block
+			uint16_t received = 0;
+			err = sd_card_await_read(sd, &buffer[block * SECTOR_SIZE], &received);
+			if(SD_SUCCESS == err) {
+				sd_card_receive_block(sd, &buffer[block * SECTOR_SIZE], received);
+			}
+		}
+		// Card streams blocks until transmission is stopped
+		sd_card_err stop_err = sd_card_execute_CMD12(sd);
+		if(SD_SUCCESS == err) err = stop_err;
+	}
+	
+	sd_card_set_enable(sd, SD_DISABLE);
+	return err;
+}
+
+sd_card_err sd_card_write_multiple(sd_card_t* sd, const uint32_t sector, const uint16_t count, const uint8_t* buffer) {
+	sd_card_err err = SD_SUCCESS;
+	if(SD_ASYNC_IDLE != sd->async_state) return SD_BUSY;
+	
+	uint32_t sector_to_write = sector;
+	if(sd->type != SD_VER_2_0_HC) sector_to_write <<= 9;
+	
+	sd_card_set_enable(sd, SD_ENABLE);
+	err = sd_card_execute_CMD25(sd, sector_to_write);
+	if(SD_SUCCESS == err) {
+		for(uint16_t block = 0; block < count && SD_SUCCESS == err; block++) {
+			sd_card_send_block(sd, MULTI_START_TOKEN, &buffer[block * SECTOR_SIZE]);
+			err = sd_card_await_block_write(sd);
+		}
+		// Stop transmission and wait for card to program last block
+		sd_card_tranfer_byte(sd, STOP_TRAN_TOKEN);
+		sd_card_tranfer_byte(sd, DUMMY_BYTE);
+		sd_card_await_busy(sd);
+		// validate write operation
+		if(SD_SUCCESS == err) err = sd_card_execute_CMD13(sd);
+	}
+	
+	sd_card_set_enable(sd, SD_DISABLE);
+	return err;
+}
+
+sd_card_err sd_card_erase(sd_card_t* sd, const uint32_t sector, const uint32_t count) {
+	sd_card_err err = SD_SUCCESS;
+	if(SD_ASYNC_IDLE != sd->async_state) return SD_BUSY;
+	if(0 == count) return err;
+	
+	uint32_t first_to_erase = sector;
+	uint32_t last_to_erase = sector + count - 1;
+	if(sd->type != SD_VER_2_0_HC) {
+		first_to_erase <<= 9;
+		last_to_erase <<= 9;
+	}
+	
+	sd_card_set_enable(sd, SD_ENABLE);
+	err = sd_card_execute_CMD32(sd, first_to_erase);
+	if(SD_SUCCESS == err) err = sd_card_execute_CMD33(sd, last_to_erase);
+	if(SD_SUCCESS == err) err = sd_card_execute_CMD38(sd);
+	
+	sd_card_set_enable(sd, SD_DISABLE);
+	return err;
+}
+
+sd_card_err sd_card_start_read(sd_card_t* sd, const uint32_t sector, uint8_t* buffer) {
+	sd_card_err err = SD_SUCCESS;
+	if(SD_ASYNC_IDLE != sd->async_state) return SD_BUSY;
+	
+	uint32_t sector_to_read = sector;
+	if(sd->type != SD_VER_2_0_HC) sector_to_read <<= 9;
+	
+	sd_card_set_enable(sd, SD_ENABLE);
+	err = sd_card_execute_CMD17(sd, sector_to_read);
+	if(SD_SUCCESS == err) {
+		// Card stays selected until data start token arrives
+		sd->async_state = SD_ASYNC_READ;
+		sd->async_buffer = buffer;
+		sd->async_polls = 0;
+	}
+	else sd_card_set_enable(sd, SD_DISABLE);
+	
+	return err;
+}
+
+sd_card_err sd_card_start_write(sd_card_t* sd, const uint32_t sector, const uint8_t* buffer) {
+	sd_card_err err = SD_SUCCESS;
+	if(SD_ASYNC_IDLE != sd->async_state) return SD_BUSY;
+	
+	uint32_t sector_to_write = sector;
+	if(sd->type != SD_VER_2_0_HC) sector_to_write <<= 9;
+	
+	sd_card_set_enable(sd, SD_ENABLE);
+	err = sd_card_execute_CMD24(sd, sector_to_write);
+	if(SD_SUCCESS == err) {
+		sd_card_send_block(sd, BLOCK_START_TOKEN, buffer);
+		uint8_t data_token = sd_card_get_resp(sd, R1_RESP_LEN, NULL);
+		if( DATA_ACCEPTED == (data_token & DATA_RESP_TOKEN) ) {
+			// Card keeps programming after being released - bus is free for other devices
+			sd->async_state = SD_ASYNC_WRITE;
+		}
+		else err = SD_WRITE_FAIL;
+	}
+	
+	sd_card_set_enable(sd, SD_DISABLE);
+	return err;
+}
+
+sd_card_err sd_card_poll(sd_card_t* sd) {
+	sd_card_err err = SD_SUCCESS;
+	
+	if(SD_ASYNC_READ == sd->async_state) {
+		uint16_t received = 0;
+		err = sd_card_poll_read_token(sd, sd->async_buffer, &received);
+		if(SD_SUCCESS == err) {
+			sd_card_receive_block(sd, sd->async_buffer, received);
+		}
+		else if(++sd->async_polls * sd_card_poll_len(sd) >= ACCESS_TIMEOUT) {
+			err = SD_READ_FAIL;
+		}
+		if(SD_BUSY != err) {
+			sd_card_set_enable(sd, SD_DISABLE);
+			err = sd_card_finish_async(sd, err);
+		}
+	}
+	else if(SD_ASYNC_WRITE == sd->async_state) {
+		// Selected card holds data line low while still busy
+		sd_card_set_enable(sd, SD_ENABLE);
+		if(0x00 == sd_card_tranfer_byte(sd, DUMMY_BYTE)) {
+			sd_card_set_enable(sd, SD_DISABLE);
+			err = SD_BUSY;
+		}
+		else {
+			// validate write operation
+			err = sd_card_execute_CMD13(sd);
+			sd_card_set_enable(sd, SD_DISABLE);
+			err = sd_card_finish_async(sd, err);
+		}
+	}
+	
+	return err;
+}
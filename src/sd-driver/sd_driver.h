@@ -22,6 +22,7 @@
 #define INIT_TIMEOUT	200
 #define COMMAND_TIMEOUT	100
 #define ACCESS_TIMEOUT	200
+#define POLL_BLOCK_LEN	8	// Bytes received at once when polling with block transfers
 
 typedef enum {
 	SD_SUCCESS,
@@ -35,6 +36,8 @@ typedef enum {
 	SD_WRITE_FAIL,		// When card was unable to store data in memory array
 	SD_WRITE_ADDR_ERR,	// Writing to unaligned sector address
 	SD_WRITE_OUT_RNG,	// Writing outside of card address range
+	SD_BUSY,			// When non-blocking transaction is still in progress
+	SD_ERASE_FAIL,		// When card rejected erase sequence
 }sd_card_err;
 
 typedef enum{
@@ -44,10 +47,26 @@ typedef enum{
 	SD_VER_2_0_HC
 } sd_card_type;
 
+typedef enum {
+	SD_ASYNC_IDLE,
+	SD_ASYNC_READ,		// Waiting for data start token - card stays selected
+	SD_ASYNC_WRITE		// Waiting for card to finish programming - card is released
+} sd_async_state;
+
 typedef struct {
 	sd_card_type type;
 	uint8_t (*spi_transfer_byte)(uint8_t);
 	void (*spi_chip_select)(uint8_t);
+	/* Optional block transfers - data phases are not moved byte by byte */
+	void (*spi_transfer_block)(const uint8_t*, uint8_t*, uint16_t);	// rx may be NULL
+	void (*spi_receive_block)(uint8_t*, uint16_t);					// clocks out 0xFF
+	/* Non-blocking transaction */
+	sd_async_state async_state;
+	uint8_t* async_buffer;
+	uint8_t async_polls;
+	/* Optional completion callback of non-blocking transaction */
+	void (*async_done)(void*, sd_card_err);
+	void* async_context;
 } sd_card_t;
 
 #define GET_SD_HANDLE(transfer_byte, chip_select) {.spi_transfer_byte = transfer_byte, .spi_chip_select = chip_select}
@@ -55,5 +74,13 @@ typedef struct {
 sd_card_err	sd_card_init(sd_card_t* sd);
 sd_card_err	sd_card_read(sd_card_t* sd, const uint32_t sector, uint8_t* buffer);
 sd_card_err	sd_card_write(sd_card_t* sd, const uint32_t sector, const uint8_t* buffer);
+sd_card_err	sd_card_read_multiple(sd_card_t* sd, const uint32_t sector, const uint16_t count, uint8_t* buffer);
+sd_card_err	sd_card_write_multiple(sd_card_t* sd, const uint32_t sector, const uint16_t count, const uint8_t* buffer);
+sd_card_err	sd_card_erase(sd_card_t* sd, const uint32_t sector, const uint32_t count);
+
+/* Non-blocking access - transaction is advanced with sd_card_poll until it stops returning SD_BUSY */
+sd_card_err	sd_card_start_read(sd_card_t* sd, const uint32_t sector, uint8_t* buffer);
+sd_card_err	sd_card_start_write(sd_card_t* sd, const uint32_t sector, const uint8_t* buffer);
+sd_card_err	sd_card_poll(sd_card_t* sd);
 
 #endif /* SD_DRIVER_H_ */
\ No newline at end of file
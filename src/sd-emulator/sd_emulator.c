@@ -0,0 +1,386 @@
+#include "sd_emulator.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "../sd-driver/sd_driver.h"
+#include "../sd-driver/commands.h"
+#include "../sd-driver/responses.h"
+
+#define DUMMY_BYTE		0xFF
+#define BUSY_BYTE		0x00
+#define COMMAND_LEN		6
+#define COMMAND_MASK	0xC0
+#define COMMAND_START	0x40
+#define QUEUE_SIZE		(SECTOR_SIZE + 8)
+
+/* Data response and data error tokens */
+#define DATA_RESP_ACCEPTED	0x05
+#define DATA_RESP_WRITE_ERR	0x0D
+#define DATA_ERROR_TOKEN	0x01
+
+typedef enum {
+	EMU_COMMAND,		// Waiting for next command
+	EMU_READ,			// Sending data blocks to host
+	EMU_WRITE_TOKEN,	// Waiting for data start token
+	EMU_WRITE_DATA		// Receiving data block from host
+} emu_state;
+
+typedef struct {
+	int fd;
+	uint32_t sector_count;
+	sd_emu_config config;
+	sd_emu_stats_t stats;
+	/* Card state */
+	uint8_t selected;
+	uint8_t idle;
+	uint8_t app_command;
+	uint8_t init_attempts;
+	emu_state state;
+	uint8_t multiple;
+	uint32_t sector;
+	/* Erase group selected with ERASE_WR_BLK_START and ERASE_WR_BLK_END */
+	uint32_t erase_first;
+	uint32_t erase_last;
+	uint8_t erase_selected;
+	/* Command being received */
+	uint8_t command[COMMAND_LEN];
+	uint8_t command_pos;
+	/* Card output - filler bytes first, then queued bytes, then busy signal */
+	uint16_t delay;
+	uint8_t queue[QUEUE_SIZE];
+	uint16_t queue_len;
+	uint16_t queue_pos;
+	uint8_t block_queued;
+	uint16_t busy;
+	/* Data block received from host with its CRC */
+	uint8_t block[SECTOR_SIZE + 2];
+	uint16_t block_pos;
+} sd_emu_t;
+
+static sd_emu_t emu = { .fd = -1 };
+
+void emu_clear_output(void) {
+	emu.delay = 0;
+	emu.queue_len = 0;
+	emu.queue_pos = 0;
+	emu.block_queued = 0;
+}
+
+void emu_queue_byte(const uint8_t byte) {
+	if (emu.queue_len < QUEUE_SIZE) emu.queue[emu.queue_len++] = byte;
+}
+
+void emu_queue_block(void) {
+	emu.delay = emu.config.read_latency;
+	off_t offset = (off_t)emu.sector * SECTOR_SIZE;
+	if (emu.sector < emu.sector_count && SECTOR_SIZE == pread(emu.fd, &emu.queue[1], SECTOR_SIZE, offset)) {
+		emu.queue[0] = BLOCK_START_TOKEN;
+		emu.queue[SECTOR_SIZE + 1] = 0x00;	// CRC is not checked in SPI mode
+		emu.queue[SECTOR_SIZE + 2] = 0x00;
+		emu.queue_len = SECTOR_SIZE + 3;
+		emu.block_queued = 1;
+		emu.sector++;
+		if (!emu.multiple) emu.state = EMU_COMMAND;
+	}
+	else {
+		emu_queue_byte(DATA_ERROR_TOKEN);
+		emu.state = EMU_COMMAND;
+	}
+}
+
+uint8_t emu_next_output(void) {
+	uint8_t byte = DUMMY_BYTE;
+
+	if (emu.delay) {
+		emu.delay--;
+		emu.stats.wait_bytes++;
+	}
+	else if (emu.queue_pos < emu.queue_len) {
+		byte = emu.queue[emu.queue_pos++];
+		if (emu.queue_pos == emu.queue_len) {
+			emu.queue_pos = emu.queue_len = 0;
+			if (emu.block_queued) emu.stats.sectors_read++;
+			emu.block_queued = 0;
+		}
+	}
+	else if (emu.busy) {
+		emu.busy--;
+		emu.stats.busy_bytes++;
+		byte = BUSY_BYTE;
+	}
+	else if (EMU_READ == emu.state) {
+		// Next block becomes available after access latency
+		emu_queue_block();
+		byte = emu_next_output();
+	}
+
+	return byte;
+}
+
+uint8_t emu_check_address(const uint32_t argument) {
+	uint8_t r1 = READY;
+
+	uint32_t sector = argument;
+	if (!emu.config.high_capacity) {
+		// Standard capacity cards are byte addressed
+		if (argument % SECTOR_SIZE) r1 = ADDRESS_ERROR;
+		sector = argument / SECTOR_SIZE;
+	}
+	if (READY == r1 && sector >= emu.sector_count) r1 = PARAMETER_ERROR;
+	emu.sector = sector;
+
+	return r1;
+}
+
+uint8_t emu_erase_blocks(void) {
+	uint8_t r1 = READY;
+
+	// Erased blocks read back as zeros
+	static const uint8_t zero[SECTOR_SIZE];
+	for (uint32_t sector = emu.erase_first; sector <= emu.erase_last && READY == r1; sector++) {
+		if (SECTOR_SIZE == pwrite(emu.fd, zero, SECTOR_SIZE, (off_t)sector * SECTOR_SIZE)) emu.stats.sectors_erased++;
+		else r1 = ERASE_RESET;
+	}
+	emu.busy = emu.config.erase_latency;
+
+	return r1;
+}
+
+void emu_execute_command(void) {
+	uint32_t argument = ((uint32_t)emu.command[1] << 24) | ((uint32_t)emu.command[2] << 16) | ((uint32_t)emu.command[3] << 8) | emu.command[4];
+	uint8_t app_command = emu.app_command;
+	emu.app_command = 0;
+	emu.stats.commands++;
+	emu_clear_output();
+
+	uint8_t response[5] = { 0 };
+	uint8_t response_len = 1;
+	uint8_t r1 = emu.idle ? IN_IDLE_STATE : READY;
+	switch (emu.command[0]) {
+		case GO_IDLE_STATE:
+			emu.idle = 1;
+			emu.init_attempts = emu.config.init_attempts;
+			emu.state = EMU_COMMAND;
+			r1 = IN_IDLE_STATE;
+		break;
+
+		case SEND_IF_COND:
+			// Echo accepted voltage range and check pattern
+			response[3] = (argument >> 8) & 0x0F;
+			response[4] = argument & 0xFF;
+			response_len = 5;
+		break;
+
+		case READ_OCR:
+			if (!emu.idle) response[1] = POW_UP_STAT | (emu.config.high_capacity ? CARD_CAPACITY : 0);
+			response[2] = 0xFF;	// 2.8V - 3.6V
+			response[3] = 0x80;	// 2.7V - 2.8V
+			response_len = 5;
+		break;
+
+		case APP_CMD:
+			emu.app_command = 1;
+		break;
+
+		case SD_SEND_OP_COND:
+			if (app_command) {
+				if (emu.init_attempts) emu.init_attempts--;
+				if (!emu.init_attempts) emu.idle = 0;
+				r1 = emu.idle ? IN_IDLE_STATE : READY;
+			}
+			else r1 |= ILLIGAL_COMMAND;
+		break;
+
+		case SEND_STATUS:
+			response_len = 2;
+		break;
+
+		case READ_SINGLE_BLOCK:
+		case READ_MULTIPLE_BLOCK:
+			if (emu.idle) r1 |= ILLIGAL_COMMAND;
+			else r1 = emu_check_address(argument);
+			if (READY == r1) {
+				emu.state = EMU_READ;
+				emu.multiple = (READ_MULTIPLE_BLOCK == emu.command[0]);
+			}
+		break;
+
+		case WRITE_BLOCK:
+		case WRITE_MULTIPLE_BLOCK:
+			if (emu.idle) r1 |= ILLIGAL_COMMAND;
+			else r1 = emu_check_address(argument);
+			if (READY == r1) {
+				emu.state = EMU_WRITE_TOKEN;
+				emu.multiple = (WRITE_MULTIPLE_BLOCK == emu.command[0]);
+			}
+		break;
+
+		case ERASE_WR_BLK_START:
+		case ERASE_WR_BLK_END:
+			if (emu.idle) r1 |= ILLIGAL_COMMAND;
+			else r1 = emu_check_address(argument);
+			if (READY == r1 && ERASE_WR_BLK_START == emu.command[0]) {
+				emu.erase_first = emu.sector;
+				emu.erase_selected = 1;
+			}
+			else if (READY == r1 && emu.erase_selected && emu.sector >= emu.erase_first) {
+				emu.erase_last = emu.sector;
+				emu.erase_selected = 2;
+			}
+			else {
+				r1 |= ERASE_SEQ_ERROR;
+				emu.erase_selected = 0;
+			}
+		break;
+
+		case ERASE:
+			// Response is followed by busy signal while blocks are erased
+			if (emu.idle) r1 |= ILLIGAL_COMMAND;
+			else if (2 != emu.erase_selected) r1 |= ERASE_SEQ_ERROR;
+			else r1 = emu_erase_blocks();
+			emu.erase_selected = 0;
+		break;
+
+		case STOP_TRANSMISSION:
+			// Stuff byte precedes response, card is busy afterwards
+			emu.state = EMU_COMMAND;
+			emu.delay = 1;
+			emu.busy = emu.config.stop_latency;
+		break;
+
+		default:
+			r1 |= ILLIGAL_COMMAND;
+		break;
+	}
+
+	response[0] = r1;
+	emu.delay += emu.config.response_latency;
+	for (uint8_t i = 0; i < response_len; i++) emu_queue_byte(response[i]);
+}
+
+void emu_program_block(void) {
+	off_t offset = (off_t)emu.sector * SECTOR_SIZE;
+	if (emu.sector < emu.sector_count && SECTOR_SIZE == pwrite(emu.fd, emu.block, SECTOR_SIZE, offset)) {
+		emu_queue_byte(DATA_RESP_ACCEPTED);
+		emu.stats.sectors_written++;
+		emu.sector++;
+	}
+	else {
+		emu_queue_byte(DATA_RESP_WRITE_ERR);
+	}
+	emu.busy = emu.config.write_latency;
+	emu.state = emu.multiple ? EMU_WRITE_TOKEN : EMU_COMMAND;
+}
+
+void emu_receive(const uint8_t byte) {
+	switch (emu.state) {
+		case EMU_WRITE_TOKEN:
+			if (byte == (emu.multiple ? MULTI_START_TOKEN : BLOCK_START_TOKEN)) {
+				emu.state = EMU_WRITE_DATA;
+				emu.block_pos = 0;
+			}
+			else if (emu.multiple && STOP_TRAN_TOKEN == byte) {
+				emu.state = EMU_COMMAND;
+				emu.busy = emu.config.stop_latency;
+			}
+		break;
+
+		case EMU_WRITE_DATA:
+			emu.block[emu.block_pos++] = byte;
+			if (sizeof(emu.block) == emu.block_pos) emu_program_block();
+		break;
+
+		default:
+			// Commands are also accepted while blocks are streamed
+			if (emu.command_pos || COMMAND_START == (byte & COMMAND_MASK)) {
+				emu.command[emu.command_pos++] = byte;
+				if (COMMAND_LEN == emu.command_pos) {
+					emu.command_pos = 0;
+					emu_execute_command();
+				}
+			}
+		break;
+	}
+}
+
+sd_emu_err sd_emu_open(const char* path, const sd_emu_config* config) {
+	sd_emu_err err = SD_EMU_SUCCESS;
+
+	sd_emu_close();
+	memset(&emu, 0, sizeof(sd_emu_t));
+	emu.config = *config;
+	emu.idle = 1;
+	emu.state = EMU_COMMAND;
+
+	struct stat image_stat;
+	emu.fd = open(path, O_RDWR);
+	if (emu.fd < 0 || fstat(emu.fd, &image_stat)) {
+		sd_emu_close();
+		err = SD_EMU_OPEN_FAIL;
+	}
+	else {
+		emu.sector_count = image_stat.st_size / SECTOR_SIZE;
+	}
+
+	return err;
+}
+
+void sd_emu_close(void) {
+	if (emu.fd >= 0) {
+		fsync(emu.fd);
+		close(emu.fd);
+	}
+	emu.fd = -1;
+}
+
+void sd_emu_get_stats(sd_emu_stats_t* stats) {
+	*stats = emu.stats;
+}
+
+void sd_emu_reset_stats(void) {
+	memset(&emu.stats, 0, sizeof(sd_emu_stats_t));
+}
+
+uint8_t emu_exchange(const uint8_t byte) {
+	uint8_t response = DUMMY_BYTE;
+
+	emu.stats.bytes_clocked++;
+	if (emu.selected) {
+		// Card shifts out its byte while the host byte is shifted in
+		response = emu_next_output();
+		emu_receive(byte);
+	}
+
+	return response;
+}
+
+uint8_t sd_emu_transfer_byte(uint8_t byte) {
+	emu.stats.transfer_calls++;
+	return emu_exchange(byte);
+}
+
+void sd_emu_transfer_block(const uint8_t* tx, uint8_t* rx, uint16_t len) {
+	emu.stats.transfer_calls++;
+	for (uint16_t i = 0; i < len; i++) {
+		uint8_t response = emu_exchange(tx[i]);
+		if (rx) rx[i] = response;
+	}
+}
+
+void sd_emu_receive_block(uint8_t* rx, uint16_t len) {
+	emu.stats.transfer_calls++;
+	for (uint16_t i = 0; i < len; i++) rx[i] = emu_exchange(DUMMY_BYTE);
+}
+
+void sd_emu_chip_select(uint8_t state) {
+	emu.selected = (SD_ENABLE == state);
+	if (!emu.selected) {
+		// Transfer in progress is abandoned, internal programming continues
+		emu_clear_output();
+		emu.command_pos = 0;
+		emu.state = EMU_COMMAND;
+	}
+}
@@ -0,0 +1,65 @@
+/*
+ * sd_emulator.h
+ *
+ * Created: 17.10.2026 16:52:18
+ * Author : agent
+ */
+
+
+#ifndef SD_EMULATOR_H_
+#define SD_EMULATOR_H_
+
+#include <stdint.h>
+
+typedef enum {
+	SD_EMU_SUCCESS,
+	SD_EMU_OPEN_FAIL	// When image file does not exist or cannot be opened for read and write
+} sd_emu_err;
+
+typedef struct {
+	/* NCR - bytes clocked before command response (1 - 8) */
+	uint8_t response_latency;
+	/* NAC - bytes clocked before data start token, must stay below ACCESS_TIMEOUT */
+	uint8_t read_latency;
+	/* Busy bytes after each programmed block */
+	uint16_t write_latency;
+	/* Busy bytes after STOP_TRANSMISSION */
+	uint16_t stop_latency;
+	/* Busy bytes after ERASE */
+	uint16_t erase_latency;
+	/* ACMD41 requests answered with idle state before card becomes ready */
+	uint8_t init_attempts;
+	/* SDHC block addressing instead of SDSC byte addressing */
+	uint8_t high_capacity;
+} sd_emu_config;
+
+#define GET_SD_EMU_CONFIG() {.response_latency = 1, .read_latency = 16, .write_latency = 64, .stop_latency = 8, .erase_latency = 256, .init_attempts = 4, .high_capacity = 1}
+
+typedef struct {
+	/* Every byte exchanged over SPI */
+	uint32_t bytes_clocked;
+	/* Calls of SPI transfer functions - byte or block */
+	uint32_t transfer_calls;
+	/* Filler bytes clocked while waiting for command response or data token */
+	uint32_t wait_bytes;
+	/* Bytes clocked while card signals busy */
+	uint32_t busy_bytes;
+	uint32_t commands;
+	uint32_t sectors_read;
+	uint32_t sectors_written;
+	uint32_t sectors_erased;
+} sd_emu_stats_t;
+
+/* Single emulated card - SPI callbacks of sd_card_t carry no context */
+sd_emu_err	sd_emu_open(const char* path, const sd_emu_config* config);
+void		sd_emu_close(void);
+void		sd_emu_get_stats(sd_emu_stats_t* stats);
+void		sd_emu_reset_stats(void);
+
+/* SPI access - signatures match sd_card_t function pointers */
+uint8_t		sd_emu_transfer_byte(uint8_t byte);
+void		sd_emu_chip_select(uint8_t state);
+void		sd_emu_transfer_block(const uint8_t* tx, uint8_t* rx, uint16_t len);
+void		sd_emu_receive_block(uint8_t* rx, uint16_t len);
+
+#endif /* SD_EMULATOR_H_ */
@@ -2,18 +2,21 @@
 
 #include <string.h>
 #include <ctype.h>
-
-#define ATTR_READ_ONLY	0x01
-#define ATTR_HIDDEN		0x02
-#define ATTR_SYSTEM		0x04
-#define ATTR_VOLUME_ID	0x08
-#define ATTR_DIRECTORY	0x10
-#define ATTR_ARCHIVE	0x20
+#include "../stats/stats.h"
 
 #define ENTRY_SIZE  32
 
 #define FS_TYPE_SIG "FAT32"
 
+#define FS_INFO_LEAD_SIG	0x41615252
+#define FS_INFO_STRUC_SIG	0x61417272
+#define FS_INFO_TRAIL_SIG	0xAA550000
+
+#define FAT_ENTRY_MASK		0x0FFFFFFF
+#define FAT_END_OF_CHAIN	0x0FFFFFF8
+
+#define FREED_RUNS			4	// Runs of released chain erased together once FAT no longer links them
+
 #define FAT_32_EMPTY_CLUSTER(cluster)
 #define FAT_32_EMPTY_ENTRY(entry) 0x00 == entry_buf[0] || 0xE5 == entry_buf[0]
 
@@ -28,6 +31,8 @@ uint8_t fat32_validate_partition(const uint8_t* buffer) {
 void fat32_read_volume_boot_record(fs_partition_t* partition, const uint32_t start_sector, const uint8_t* vbr_buf) {
 	uint8_t BPB_NumFATs = 0;
 	uint16_t BPB_RsvdSecCnt = 0;
+	uint16_t BPB_FSInfo = 0;
+	uint32_t BPB_TotSec32 = 0;
 
 	memcpy(&partition->bytes_per_sector, &vbr_buf[0x000B], sizeof(uint16_t));
 	memcpy(&partition->sectors_per_cluster, &vbr_buf[0x000D], sizeof(uint8_t));
@@ -35,15 +40,116 @@ void fat32_read_volume_boot_record(fs_partition_t* partition, const uint32_t sta
 	memcpy(&BPB_NumFATs, &vbr_buf[0x0010], sizeof(uint8_t));
 	memcpy(&partition->sectors_pre_fat, &vbr_buf[0x0024], sizeof(uint32_t));
 	memcpy(&partition->root_cluster, &vbr_buf[0x002C], sizeof(uint32_t));
+	memcpy(&BPB_TotSec32, &vbr_buf[0x0020], sizeof(uint32_t));
+	memcpy(&BPB_FSInfo, &vbr_buf[0x0030], sizeof(uint16_t));
 
 	partition->fat_start_sector = start_sector + BPB_RsvdSecCnt;
+	partition->num_fats = BPB_NumFATs;
+	partition->fat_dirty_count = 0;
 	partition->data_start_sector = start_sector + BPB_RsvdSecCnt + (BPB_NumFATs * partition->sectors_pre_fat);
+	partition->cluster_count = (BPB_TotSec32 - (partition->data_start_sector - start_sector)) / partition->sectors_per_cluster;
+	partition->fs_info_sector = start_sector + BPB_FSInfo;
+}
+
+uint8_t fat32_validate_fs_info(const uint8_t* buffer) {
+	uint32_t lead_sig, struc_sig, trail_sig;
+	memcpy(&lead_sig, &buffer[0], sizeof(uint32_t));
+	memcpy(&struc_sig, &buffer[484], sizeof(uint32_t));
+	memcpy(&trail_sig, &buffer[508], sizeof(uint32_t));
+	return (FS_INFO_LEAD_SIG != lead_sig || FS_INFO_STRUC_SIG != struc_sig || FS_INFO_TRAIL_SIG != trail_sig);
+}
+
+fs_error fat32_read_fs_info(fs_partition_t* partition) {
+	fs_error err = FS_SUCCESS;
+
+	partition->free_count = FS_INFO_UNKNOWN;
+	partition->next_free = FS_INFO_UNKNOWN;
+	partition->fs_info_dirty = 0;
+	err = read_buffered_sector(partition->device, partition->fs_info_sector);
+	if (FS_SUCCESS == err) {
+		uint8_t* fs_info = get_raw_buffer(partition->device);
+		if (!fat32_validate_fs_info(fs_info)) {
+			memcpy(&partition->free_count, &fs_info[488], sizeof(uint32_t));
+			memcpy(&partition->next_free, &fs_info[492], sizeof(uint32_t));
+		}
+		// Values are only hints - drop those not matching this volume
+		if (partition->free_count > partition->cluster_count) partition->free_count = FS_INFO_UNKNOWN;
+		if (partition->next_free < 2 || partition->next_free > partition->cluster_count + 1) partition->next_free = FS_INFO_UNKNOWN;
+	}
+
+	return err;
+}
+
+uint8_t fat32_map_test(const uint8_t* map, const uint32_t bit) {
+	return map[bit / 8] & (1 << (bit % 8));
+}
+
+void fat32_map_update(uint8_t* map, const uint32_t bit, const uint8_t value) {
+	if (value) map[bit / 8] |= (1 << (bit % 8));
+	else map[bit / 8] &= ~(1 << (bit % 8));
+}
+
+uint32_t fat32_map_find_clear(const uint8_t* map, const uint32_t first, const uint32_t end) {
+	uint32_t bit = first;
+	while (bit < end) {
+		if (0 == bit % 8 && bit + 8 <= end && 0xFF == map[bit / 8]) bit += 8;	// Skip fully used bytes at once
+		else if (!fat32_map_test(map, bit)) break;
+		else bit++;
+	}
+	return (bit < end) ? bit : end;
+}
+
+fs_error fat32_build_alloc_map(fs_partition_t* partition) {
+	fs_error err = FS_SUCCESS;
+
+	uint32_t last_cluster = partition->cluster_count + 1;
+	partition->alloc_map_mode = FS_MAP_NONE;
+	if (NULL != partition->alloc_map) {
+		if (partition->alloc_map_size >= last_cluster / 8 + 1) {
+			partition->alloc_map_mode = FS_MAP_CLUSTERS;
+			memset(partition->alloc_map, 0, last_cluster / 8 + 1);
+		}
+		else if (partition->alloc_map_size >= (partition->sectors_pre_fat + 7) / 8) {
+			partition->alloc_map_mode = FS_MAP_FAT_SECTORS;
+			memset(partition->alloc_map, 0, (partition->sectors_pre_fat + 7) / 8);
+		}
+	}
+
+	if (FS_MAP_NONE != partition->alloc_map_mode) {
+		uint32_t free_count = 0;
+		uint32_t fat_sectors = last_cluster / 128 + 1;
+		for (uint32_t sector = 0; sector < fat_sectors && FS_SUCCESS == err; sector++) {
+			err = read_buffered_sector(partition->fat_device, partition->fat_start_sector + sector);
+			uint8_t full = 1;
+			for (uint32_t cluster = sector * 128; cluster < (sector + 1) * 128 && cluster <= last_cluster && FS_SUCCESS == err; cluster++) {
+				uint32_t fat_entry = 0;
+				memcpy(&fat_entry, &get_raw_buffer(partition->fat_device)[(cluster % 128) * 4], sizeof(uint32_t));
+				if (cluster >= 2 && 0 == (fat_entry & FAT_ENTRY_MASK)) {
+					free_count++;
+					full = 0;
+				}
+				else if (FS_MAP_CLUSTERS == partition->alloc_map_mode) {
+					fat32_map_update(partition->alloc_map, cluster, 1);
+				}
+			}
+			if (FS_MAP_FAT_SECTORS == partition->alloc_map_mode && full) {
+				fat32_map_update(partition->alloc_map, sector, 1);
+			}
+		}
+		// Whole FAT was read - count is exact
+		if (FS_SUCCESS == err && free_count != partition->free_count) {
+			partition->free_count = free_count;
+			partition->fs_info_dirty = 1;
+		}
+	}
+
+	return err;
 }
 
 void fat32_read_file_entry(fat_entry_t* file, const uint8_t* entry_buf) {
 	memcpy(&file->attributes, &entry_buf[0x0b], sizeof(uint8_t));
 	memcpy(&file->file_size, &entry_buf[0x1c], sizeof(uint32_t));
-	memcpy(&((uint8_t*)&file->starting_cluster)[1], &entry_buf[0x14], sizeof(uint16_t));
+	memcpy(&((uint8_t*)&file->starting_cluster)[2], &entry_buf[0x14], sizeof(uint16_t));
 	memcpy(&((uint8_t*)&file->starting_cluster)[0], &entry_buf[0x1a], sizeof(uint16_t));
 }
 
@@ -68,7 +174,7 @@ void fat32_write_file_entry(uint8_t* entry_buf, const fat_entry_t* file) {
 	uint16_t last_access_date = CONVERT_TO_FAT_DATE(41, 4, 15);
 	memcpy(&entry_buf[18], &last_access_date, sizeof(uint16_t));
 
-	memcpy(&entry_buf[0x14], &((uint8_t*)&file->starting_cluster)[1], sizeof(uint16_t));
+	memcpy(&entry_buf[0x14], &((uint8_t*)&file->starting_cluster)[2], sizeof(uint16_t));
 
 	uint16_t last_write_time = CONVERT_TO_FAT_TIME(12, 10, 10);
 	memcpy(&entry_buf[22], &last_write_time, sizeof(uint16_t));
@@ -81,6 +187,16 @@ void fat32_write_file_entry(uint8_t* entry_buf, const fat_entry_t* file) {
 	memcpy(&entry_buf[0x1c], &file->file_size, sizeof(uint32_t));
 }
 
+void fat32_read_short_name(uint8_t* name, const uint8_t* entry_buf) {
+	uint8_t j = 0;
+	for (uint8_t i = 0; i < 11; i++) {
+		if (8 == i && ' ' != entry_buf[i]) name[j++] = '.';	// dot only before non empty ext
+		if (' ' != entry_buf[i]) name[j++] = tolower(entry_buf[i]);
+	}
+	if (j && 0x05 == entry_buf[0]) name[0] = 0xE5;	// 0xE5 lead byte is stored as 0x05
+	name[j] = '\0';
+}
+
 uint8_t fat32_match_short_name(const uint8_t* entry_buf, const uint8_t* name, const uint8_t length) {
 	size_t j = 0;
 	for (size_t i = 0; i < 11 && j < length; i++) {
@@ -123,15 +239,34 @@ fs_error fat32_clear_cluster(const fs_partition_t* partition, const uint32_t* cl
 	uint32_t sector_to_clean = fat32_get_cluster_sector(partition, cluster);
 	uint8_t sectors_per_cluster = partition->sectors_per_cluster;
 	sector_to_clean += (sectors_per_cluster - 1);   // Start clearing cluster's sectors from the end
-	for (uint8_t sector = 0; sector < sectors_per_cluster; sector++) {
-		memset(get_raw_buffer(partition->device), 0, SECTOR_SIZE);
-		err = write_buffered_sector(partition->device, sector_to_clean - sector);
+	for (uint8_t sector = 0; sector < sectors_per_cluster && FS_SUCCESS == err; sector++) {
+		err = clear_buffered_sector(partition->device, sector_to_clean - sector);
+		if (FS_SUCCESS == err) {
+			err = write_buffered_sector(partition->device, sector_to_clean - sector);
+		}
 	}
 
 	return err;
 }
 
 
+void fat32_init_fat_cache(fs_partition_t* partition) {
+	partition->fat_device = partition->device;
+	// Mapped devices access FAT in place - there is nothing to cache
+	if (partition->fat_slot_count && NULL != partition->fat_buffer && NULL != partition->fat_slots && NULL == partition->device->map_sector) {
+		// Same storage media and policy as file data, own buffer memory
+		partition->fat_cache = *partition->device;
+		partition->fat_cache.buffer = partition->fat_buffer;
+		partition->fat_cache.slots = partition->fat_slots;
+		partition->fat_cache.slot_count = partition->fat_slot_count;
+		partition->fat_cache.current = 0;
+		partition->fat_cache.hits = 0;
+		partition->fat_cache.misses = 0;
+		memset(partition->fat_slots, 0, partition->fat_slot_count * sizeof(fs_cache_slot));
+		partition->fat_device = &partition->fat_cache;
+	}
+}
+
 fs_error fat32_mount_partition(fs_partition_t* partition, const uint32_t start_sector) {
 	fs_error err = FS_SUCCESS;
 
@@ -140,6 +275,19 @@ fs_error fat32_mount_partition(fs_partition_t* partition, const uint32_t start_s
 		uint8_t* boot_sector = get_raw_buffer(partition->device);
 		if (!fat32_validate_partition(boot_sector)) {
 			fat32_read_volume_boot_record(partition, start_sector, boot_sector);
+			fat32_init_fat_cache(partition);
+			if (partition->dir_cache_size && NULL != partition->dir_cache) {
+				memset(partition->dir_cache, 0, partition->dir_cache_size * sizeof(fs_dir_cache_entry));
+			}
+			else {
+				partition->dir_cache_size = 0;
+			}
+			partition->dir_cache_next = 0;
+			partition->buffered_files = NULL;
+			err = fat32_read_fs_info(partition);
+			if (FS_SUCCESS == err) {
+				err = fat32_build_alloc_map(partition);
+			}
 		}
 		else {
 			err = FS_UNSUPPORTED_FS;
@@ -149,13 +297,168 @@ fs_error fat32_mount_partition(fs_partition_t* partition, const uint32_t start_s
 	return err;
 }
 
-fs_error fat32_find_entry(const fs_partition_t* partition, fat_entry_t* entry, const uint8_t* name, const uint8_t name_len) {
+fs_error fat32_sync_fs_info(fs_partition_t* partition) {
+	fs_error err = FS_SUCCESS;
+
+	if (partition->fs_info_dirty) {
+		err = read_buffered_sector(partition->device, partition->fs_info_sector);
+		if (FS_SUCCESS == err) {
+			uint8_t* fs_info = get_raw_buffer(partition->device);
+			if (!fat32_validate_fs_info(fs_info)) {
+				memcpy(&fs_info[488], &partition->free_count, sizeof(uint32_t));
+				memcpy(&fs_info[492], &partition->next_free, sizeof(uint32_t));
+				err = write_buffered_sector(partition->device, partition->fs_info_sector);
+			}
+			if (FS_SUCCESS == err) partition->fs_info_dirty = 0;
+		}
+	}
+
+	return err;
+}
+
+void fat32_mark_fat_sector(fs_partition_t* partition, const uint32_t fat_sector) {
+	if (partition->num_fats > 1) {
+		// Sectors are remembered as few ranges - adjacent sectors extend existing range
+		uint32_t sector = fat_sector - partition->fat_start_sector;
+		uint8_t closest = 0;
+		uint32_t closest_distance = UINT32_MAX;
+		uint8_t range_id = 0;
+		for (; range_id < partition->fat_dirty_count; range_id++) {
+			fs_sector_range* range = &partition->fat_dirty[range_id];
+			if (sector + 1 >= range->first && sector <= range->last + 1) break;
+			uint32_t distance = (sector < range->first) ? range->first - sector : sector - range->last;
+			if (distance < closest_distance) {
+				closest = range_id;
+				closest_distance = distance;
+			}
+		}
+		if (range_id == partition->fat_dirty_count) {
+			if (partition->fat_dirty_count < FAT_MIRROR_RANGES) {
+				partition->fat_dirty[partition->fat_dirty_count].first = sector;
+				partition->fat_dirty[partition->fat_dirty_count].last = sector;
+				partition->fat_dirty_count++;
+			}
+			else {
+				range_id = closest;		// All ranges used - closest one grows to cover the sector
+			}
+		}
+		fs_sector_range* range = &partition->fat_dirty[range_id];
+		if (sector < range->first) range->first = sector;
+		if (sector > range->last) range->last = sector;
+	}
+}
+
+fs_error fat32_sync_fat_copies(fs_partition_t* partition) {
+	fs_error err = FS_SUCCESS;
+
+	// With separate FAT cache its buffer serves for multi-sector copying - slots have to be stored first
+	uint16_t batch = 1;
+	if (partition->fat_device != partition->device && partition->fat_dirty_count) {
+		err = flush_buffered_sectors(partition->fat_device);
+		if (FS_SUCCESS == err) {	// Slots still holding unstored entries must not be dropped
+			memset(partition->fat_slots, 0, partition->fat_slot_count * sizeof(fs_cache_slot));
+			batch = partition->fat_slot_count;
+		}
+	}
+
+	for (uint8_t range_id = 0; range_id < partition->fat_dirty_count && FS_SUCCESS == err; range_id++) {
+		fs_sector_range* range = &partition->fat_dirty[range_id];
+		for (uint32_t sector = range->first; sector <= range->last && FS_SUCCESS == err; sector += batch) {
+			uint16_t count = (range->last - sector + 1 < batch) ? range->last - sector + 1 : batch;
+			uint8_t* buffer = partition->fat_buffer;
+			if (1 == batch) {
+				err = read_buffered_sector(partition->fat_device, partition->fat_start_sector + sector);
+				buffer = get_raw_buffer(partition->fat_device);
+			}
+			else {
+				err = read_direct_sectors(partition->device, partition->fat_start_sector + sector, count, buffer);
+			}
+			for (uint8_t copy = 1; copy < partition->num_fats && FS_SUCCESS == err; copy++) {
+				uint32_t copy_sector = partition->fat_start_sector + copy * partition->sectors_pre_fat + sector;
+				err = write_direct_sectors(partition->device, copy_sector, count, buffer);
+			}
+		}
+	}
+	if (FS_SUCCESS == err) {
+		partition->fat_dirty_count = 0;
+	}
+
+	return err;
+}
+
+fs_error fat32_flush_fat(fs_partition_t* partition) {
+	fs_error err = FS_SUCCESS;
+
+	if (partition->fat_device != partition->device) {
+		err = flush_buffered_sectors(partition->fat_device);
+	}
+
+	return err;
+}
+
+uint32_t fat32_hash_name(const uint8_t* name, const uint8_t length) {
+	uint32_t hash = 2166136261UL;	// FNV-1a
+	for (uint8_t i = 0; i < length; i++) {
+		hash = (hash ^ name[i]) * 16777619UL;
+	}
+	return hash;
+}
+
+void fat32_cache_entry(fs_partition_t* partition, const uint32_t parent_cluster, const uint32_t name_hash, const fat_entry_t* entry, const uint8_t* entry_buf) {
+	if (partition->dir_cache_size) {
+		// Slots are reused in round robin order
+		fs_dir_cache_entry* cached = &partition->dir_cache[partition->dir_cache_next];
+		cached->parent_cluster = parent_cluster;
+		cached->name_hash = name_hash;
+		memcpy(cached->short_name, entry_buf, sizeof(cached->short_name));
+		cached->entry = *entry;
+		partition->dir_cache_next = (partition->dir_cache_next + 1) % partition->dir_cache_size;
+	}
+}
+
+void fat32_refresh_cached_entry(fs_partition_t* partition, const fat_entry_t* entry, const uint8_t* entry_buf) {
+	// Cached copy follows every store of the directory entry
+	for (uint8_t slot = 0; slot < partition->dir_cache_size; slot++) {
+		fs_dir_cache_entry* cached = &partition->dir_cache[slot];
+		if (cached->entry.root_dir_cluster == entry->root_dir_cluster && cached->entry.root_dir_offset == entry->root_dir_offset) {
+			fat32_read_file_entry(&cached->entry, entry_buf);
+		}
+	}
+}
+
+fs_error fat32_find_cached_entry(fs_partition_t* partition, fat_entry_t* entry, const uint32_t name_hash, const uint8_t* name, const uint8_t name_len) {
+	fs_error err = FS_FILE_NOT_FOUND;
+
+	for (uint8_t slot = 0; slot < partition->dir_cache_size && FS_FILE_NOT_FOUND == err; slot++) {
+		fs_dir_cache_entry* cached = &partition->dir_cache[slot];
+		if (cached->entry.root_dir_cluster && cached->name_hash == name_hash && cached->parent_cluster == entry->starting_cluster) {
+			// Name is compared again - hash collision must not open another file
+			if (!fat32_match_short_name(cached->short_name, name, name_len)) {
+				*entry = cached->entry;
+				err = FS_SUCCESS;
+			}
+		}
+	}
+
+	return err;
+}
+
+fs_error fat32_find_entry(fs_partition_t* partition, fat_entry_t* entry, const uint8_t* name, const uint8_t name_len) {
 	fs_error err = FS_SUCCESS;
 	
+	uint32_t parent_cluster = entry->starting_cluster;
 	uint32_t dir_cluster = entry->starting_cluster;
+	uint32_t name_hash = fat32_hash_name(name, name_len);
+	err = fat32_find_cached_entry(partition, entry, name_hash, name, name_len);
+	if (FS_SUCCESS == err) {
+		return err;		// Found in cache - directory is not read at all
+	}
+	err = FS_SUCCESS;
+
 	while (FS_SUCCESS == err) {
 		uint32_t sector = fat32_get_cluster_sector(partition, &dir_cluster);
 		for (uint8_t sector_id = 0; sector_id < partition->sectors_per_cluster; sector_id++) {
+			FS_STATS_INC(dir_scanned_sectors);
 			err = read_buffered_sector(partition->device, (sector + sector_id));
 			if (FS_SUCCESS == err) {
 				uint8_t* dir_buff = get_raw_buffer(partition->device);
@@ -167,7 +470,8 @@ fs_error fat32_find_entry(const fs_partition_t* partition, fat_entry_t* entry, c
 					else if (!fat32_match_short_name(entry_buf, name, name_len)) {
 						fat32_read_file_entry(entry, entry_buf);
 						entry->root_dir_cluster = dir_cluster;
-						entry->root_dir_offset = entry_offset;
+						entry->root_dir_offset = sector_id * SECTOR_SIZE + entry_offset;
+						fat32_cache_entry(partition, parent_cluster, name_hash, entry, entry_buf);
 						return FS_SUCCESS;
 					}
 				}
@@ -182,9 +486,54 @@ fs_error fat32_find_entry(const fs_partition_t* partition, fat_entry_t* entry, c
 	return err;
 }
 
-fs_error fat32_create_entry(const fs_partition_t* partition, fat_entry_t* entry, const uint8_t* name, const uint8_t name_len) {
+fs_error fat32_read_dir_entry(fs_partition_t* partition, uint32_t* dir_cluster, uint16_t* dir_offset, fat_entry_t* entry, uint8_t* name) {
 	fs_error err = FS_SUCCESS;
 
+	uint8_t found = 0;
+	while (FS_SUCCESS == err && !found) {
+		if (0 == *dir_cluster) {
+			return FS_END_OF_DIR;
+		}
+		uint32_t sector = fat32_get_cluster_sector(partition, dir_cluster) + *dir_offset / SECTOR_SIZE;
+		if (0 == *dir_offset % SECTOR_SIZE) {
+			FS_STATS_INC(dir_scanned_sectors);
+		}
+		err = read_buffered_sector(partition->device, sector);
+		if (FS_SUCCESS == err) {
+			uint8_t* entry_buf = &get_raw_buffer(partition->device)[*dir_offset % SECTOR_SIZE];
+			if (0x00 == entry_buf[0]) {
+				*dir_cluster = 0;	// No entries follow
+				return FS_END_OF_DIR;
+			}
+			// Deleted entries, volume label and long name parts are skipped
+			if (!(FAT_32_EMPTY_ENTRY(entry_buf)) && !(entry_buf[0x0b] & ATTR_VOLUME_ID)) {
+				fat32_read_file_entry(entry, entry_buf);
+				fat32_read_short_name(name, entry_buf);
+				entry->root_dir_cluster = *dir_cluster;
+				entry->root_dir_offset = *dir_offset;
+				found = 1;
+			}
+			// Cluster of 64 KiB does not fit offset - next cluster is looked up right after its last entry
+			uint32_t next_offset = (uint32_t)*dir_offset + ENTRY_SIZE;
+			if (next_offset >= (uint32_t)partition->sectors_per_cluster * SECTOR_SIZE) {
+				next_offset = 0;
+				err = fat32_find_next_cluster(partition, dir_cluster);
+				if (FS_END_OF_CHAIN == err) {
+					*dir_cluster = 0;
+					err = FS_SUCCESS;
+				}
+			}
+			*dir_offset = next_offset;
+		}
+	}
+
+	return err;
+}
+
+fs_error fat32_create_entry(fs_partition_t* partition, fat_entry_t* entry, const uint8_t* name, const uint8_t name_len) {
+	fs_error err = FS_SUCCESS;
+
+	uint32_t parent_cluster = entry->starting_cluster;
 	uint32_t dir_cluster = entry->starting_cluster;
 	while (FS_SUCCESS == err) {
 		uint32_t sector = fat32_get_cluster_sector(partition, &dir_cluster);
@@ -198,32 +547,34 @@ fs_error fat32_create_entry(const fs_partition_t* partition, fat_entry_t* entry,
 						entry->starting_cluster = 0;
 						entry->file_size = 0;
 						entry->root_dir_cluster = dir_cluster;
-						entry->root_dir_offset = entry_offset;
-						set_pending_write(partition->device);
+						entry->root_dir_offset = sector_id * SECTOR_SIZE + entry_offset;
+						err = set_pending_write(partition->device);
 						fat32_write_short_name(entry_buf, name, name_len);
 						fat32_write_file_entry(entry_buf, entry);
-						return FS_SUCCESS;
+						fat32_cache_entry(partition, parent_cluster, fat32_hash_name(name, name_len), entry, entry_buf);
+						return err;
 					}
 				}
 			}
 		}
 		err = fat32_find_next_cluster(partition, &dir_cluster);
 		if (FS_END_OF_CHAIN == err) {
-			err = fat32_alloc_new_cluster(partition, &dir_cluster);
+			err = fat32_alloc_new_cluster(partition, &dir_cluster, 1);
 		}
 	}
 	return err;
 }
 
-fs_error fat32_update_entry(const fs_partition_t* partition, fat_entry_t* file) {
+fs_error fat32_update_entry(fs_partition_t* partition, fat_entry_t* file) {
 	fs_error err = FS_SUCCESS;
 
 	uint32_t sector = fat32_get_cluster_sector(partition, &file->root_dir_cluster);
 	sector += file->root_dir_offset / SECTOR_SIZE;
 	err = read_buffered_sector(partition->device, sector);
 	if (FS_SUCCESS == err) {
-		uint8_t* buffer_entry = &get_raw_buffer(partition->device)[file->root_dir_offset];
+		uint8_t* buffer_entry = &get_raw_buffer(partition->device)[file->root_dir_offset % SECTOR_SIZE];
 		fat32_write_file_entry(buffer_entry, file);
+		fat32_refresh_cached_entry(partition, file, buffer_entry);
 		err = write_buffered_sector(partition->device, sector);
 	}
 
@@ -241,13 +592,14 @@ fs_error fat32_find_next_cluster(const fs_partition_t* partition, uint32_t* clus
 	uint32_t current_FAT_entry = *cluster * 4;
 	uint32_t current_FAT_sector = partition->fat_start_sector + (current_FAT_entry / SECTOR_SIZE);  // counted from zero
 	
-	err = read_buffered_sector(partition->device, current_FAT_sector);
+	FS_STATS_INC(fat_lookups);
+	err = read_buffered_sector(partition->fat_device, current_FAT_sector);
 	if (err == FS_SUCCESS) {
-		uint8_t* fat_entry_buff = &partition->device->buffer[current_FAT_entry % SECTOR_SIZE];
+		uint8_t* fat_entry_buff = &get_raw_buffer(partition->fat_device)[current_FAT_entry % SECTOR_SIZE];
 		memcpy(&next_FAT_entry, fat_entry_buff, sizeof(uint32_t));
 		// TODO change to validation for correct file entry
-		if (0x0fffffff != next_FAT_entry) {
-			*cluster = next_FAT_entry;
+		if ((next_FAT_entry & FAT_ENTRY_MASK) < FAT_END_OF_CHAIN) {
+			*cluster = next_FAT_entry & FAT_ENTRY_MASK;
 		}
 		else {
 			err = FS_END_OF_CHAIN;
@@ -257,35 +609,103 @@ fs_error fat32_find_next_cluster(const fs_partition_t* partition, uint32_t* clus
 	return err;
 }
 
-fs_error fat32_alloc_new_cluster(const fs_partition_t* partition, uint32_t* last_cluster) {
+fs_error fat32_find_free_cluster(fs_partition_t* partition, uint32_t* cluster) {
 	fs_error err = FS_SUCCESS;
 
+	// Search starts from hint and wraps around at the end of FAT
+	uint32_t last_cluster = partition->cluster_count + 1;
+	uint32_t free_cluster_id = partition->next_free;
+	if (FS_INFO_UNKNOWN == free_cluster_id) free_cluster_id = 2;
+
 	uint8_t found = 0;
-	uint32_t free_cluster = 0;
-	for (uint32_t sector = 0; sector < partition->sectors_pre_fat && !found; sector++) {
-		err = read_buffered_sector(partition->device, partition->fat_start_sector + sector);
-		for (uint8_t entry = 0; entry < 128 && FS_SUCCESS == err && !found; entry++) {
-			memcpy(&free_cluster, &partition->device->buffer[entry * 4], sizeof(uint32_t));
-			if (0 == free_cluster) {
-				found = 1;
+	if (FS_MAP_CLUSTERS == partition->alloc_map_mode) {
+		uint32_t free_bit = fat32_map_find_clear(partition->alloc_map, free_cluster_id, last_cluster + 1);
+		if (free_bit > last_cluster) {
+			free_bit = fat32_map_find_clear(partition->alloc_map, 2, free_cluster_id);
+			if (free_bit == free_cluster_id) free_bit = last_cluster + 1;
+		}
+		found = (free_bit <= last_cluster);
+		free_cluster_id = free_bit;
+	}
+	for (uint32_t checked = 0; FS_MAP_CLUSTERS != partition->alloc_map_mode && checked < partition->cluster_count && FS_SUCCESS == err && !found;) {
+		uint32_t sector = free_cluster_id / 128;
+		uint16_t entries = 128 - free_cluster_id % 128;		// Entries left in this FAT sector
+		if (free_cluster_id + entries > last_cluster + 1) entries = last_cluster + 1 - free_cluster_id;
+
+		// Sectors known to have no free entries are skipped without reading
+		if (FS_MAP_FAT_SECTORS != partition->alloc_map_mode || !fat32_map_test(partition->alloc_map, sector)) {
+			FS_STATS_INC(alloc_scanned_sectors);
+			err = read_buffered_sector(partition->fat_device, partition->fat_start_sector + sector);
+			uint8_t* fat_buff = get_raw_buffer(partition->fat_device);
+			for (uint16_t entry = 0; entry < entries && FS_SUCCESS == err && !found; entry++) {
+				uint32_t fat_entry = 0;
+				memcpy(&fat_entry, &fat_buff[((free_cluster_id + entry) % 128) * 4], sizeof(uint32_t));
+				if (0 == (fat_entry & FAT_ENTRY_MASK)) {
+					found = 1;
+					free_cluster_id += entry;
+				}
+			}
+			// Whole sector was checked - remember it is full
+			if (FS_SUCCESS == err && !found && FS_MAP_FAT_SECTORS == partition->alloc_map_mode && (0 == free_cluster_id % 128 || 2 == free_cluster_id)) {
+				fat32_map_update(partition->alloc_map, sector, 1);
+			}
+		}
+		if (!found) {
+			checked += entries;
+			free_cluster_id += entries;
+			if (free_cluster_id > last_cluster) free_cluster_id = 2;
+		}
+	}
 
-				free_cluster = 0x0FFFFFFF;  // Mark as end of chain
-				memcpy(&partition->device->buffer[entry * 4], &free_cluster, sizeof(uint32_t));
-				write_buffered_sector(partition->device, partition->fat_start_sector + sector);
+	if (FS_SUCCESS == err) {
+		if (found) *cluster = free_cluster_id;
+		else err = FS_DISK_FULL;
+	}
 
-				uint32_t free_cluster_id = sector * 128 + entry;
-				if (0 != *last_cluster) {
-					uint32_t current_FAT_entry = *last_cluster * 4;
-					uint32_t current_FAT_sector = partition->fat_start_sector + (current_FAT_entry / SECTOR_SIZE);  // counted from zero
+	return err;
+}
 
-					err = read_buffered_sector(partition->device, current_FAT_sector);
+fs_error fat32_alloc_new_cluster(fs_partition_t* partition, uint32_t* last_cluster, const uint8_t is_directory) {
+	fs_error err = FS_SUCCESS;
 
-					uint8_t* fat_entry_buff = &partition->device->buffer[current_FAT_entry % SECTOR_SIZE];
-					memcpy(fat_entry_buff, &free_cluster_id, sizeof(uint32_t));
+	uint32_t free_cluster_id = 0;
+	err = fat32_find_free_cluster(partition, &free_cluster_id);
+	if (FS_SUCCESS == err) {
+		uint32_t free_FAT_entry = free_cluster_id * 4;
+		uint32_t free_FAT_sector = partition->fat_start_sector + (free_FAT_entry / SECTOR_SIZE);  // counted from zero
+
+		err = read_buffered_sector(partition->fat_device, free_FAT_sector);
+		if (FS_SUCCESS == err) {
+			uint32_t free_cluster = 0x0FFFFFFF;  // Mark as end of chain
+			memcpy(&get_raw_buffer(partition->fat_device)[free_FAT_entry % SECTOR_SIZE], &free_cluster, sizeof(uint32_t));
+			err = write_buffered_sector(partition->fat_device, free_FAT_sector);
+		}
+		if (FS_SUCCESS == err) {
+			fat32_mark_fat_sector(partition, free_FAT_sector);
+			partition->next_free = (free_cluster_id < partition->cluster_count + 1) ? free_cluster_id + 1 : 2;
+			if (FS_INFO_UNKNOWN != partition->free_count && partition->free_count) partition->free_count--;
+			partition->fs_info_dirty = 1;
+			if (FS_MAP_CLUSTERS == partition->alloc_map_mode) {
+				fat32_map_update(partition->alloc_map, free_cluster_id, 1);
+			}
 
-					write_buffered_sector(partition->device, current_FAT_sector);
+			if (0 != *last_cluster) {
+				uint32_t current_FAT_entry = *last_cluster * 4;
+				uint32_t current_FAT_sector = partition->fat_start_sector + (current_FAT_entry / SECTOR_SIZE);  // counted from zero
+
+				err = read_buffered_sector(partition->fat_device, current_FAT_sector);
+				if (FS_SUCCESS == err) {
+					uint8_t* fat_entry_buff = &get_raw_buffer(partition->fat_device)[current_FAT_entry % SECTOR_SIZE];
+					memcpy(fat_entry_buff, &free_cluster_id, sizeof(uint32_t));
+					err = write_buffered_sector(partition->fat_device, current_FAT_sector);
 				}
-				*last_cluster = free_cluster_id;
+				if (FS_SUCCESS == err) fat32_mark_fat_sector(partition, current_FAT_sector);
+			}
+		}
+		if (FS_SUCCESS == err) {
+			*last_cluster = free_cluster_id;
+			// Directory must not show stale entries - file data clusters are simply overwritten
+			if (is_directory) {
 				err = fat32_clear_cluster(partition, &free_cluster_id);
 			}
 		}
@@ -294,30 +714,291 @@ fs_error fat32_alloc_new_cluster(const fs_partition_t* partition, uint32_t* last
 	return err;
 }
 
-fs_error fat32_free_cluster_chain(const fs_partition_t* partition, uint32_t* first_cluster) {
+fs_error fat32_find_free_run(fs_partition_t* partition, const uint32_t start_cluster, const uint32_t count, const uint8_t first_fit, uint32_t* first_cluster, uint32_t* length) {
+	fs_error err = FS_SUCCESS;
+
+	// Whole volume is searched from start for the first run long enough, otherwise the longest one is returned.
+	// With first_fit the first free run is returned as soon as it ends.
+	uint32_t last_cluster = partition->cluster_count + 1;
+	uint32_t cluster_id = start_cluster;
+
+	uint32_t run_start = 0;
+	uint32_t run_length = 0;
+	uint8_t run_ended = 0;
+	*length = 0;
+	for (uint32_t checked = 0; checked < partition->cluster_count && FS_SUCCESS == err && *length < count && !run_ended; checked++) {
+		uint8_t is_free = 0;
+		if (FS_MAP_CLUSTERS == partition->alloc_map_mode) {
+			is_free = !fat32_map_test(partition->alloc_map, cluster_id);
+		}
+		else if (FS_MAP_FAT_SECTORS != partition->alloc_map_mode || !fat32_map_test(partition->alloc_map, cluster_id / 128)) {
+			if (0 == checked || 0 == cluster_id % 128) FS_STATS_INC(alloc_scanned_sectors);
+			err = read_buffered_sector(partition->fat_device, partition->fat_start_sector + cluster_id / 128);
+			uint32_t fat_entry = 0;
+			memcpy(&fat_entry, &get_raw_buffer(partition->fat_device)[(cluster_id % 128) * 4], sizeof(uint32_t));
+			is_free = (0 == (fat_entry & FAT_ENTRY_MASK));
+		}
+
+		if (is_free) {
+			if (0 == run_length) run_start = cluster_id;
+			run_length++;
+			if (run_length > *length) {
+				*first_cluster = run_start;
+				*length = run_length;
+			}
+		}
+		else {
+			run_length = 0;
+		}
+
+		cluster_id++;
+		if (cluster_id > last_cluster) {
+			cluster_id = 2;
+			run_length = 0;		// Run cannot wrap around end of FAT
+		}
+		run_ended = first_fit && *length && 0 == run_length;
+	}
+
+	if (FS_SUCCESS == err && 0 == *length) {
+		err = FS_DISK_FULL;
+	}
+
+	return err;
+}
+
+void fat32_clear_cluster_run(fs_partition_t* partition, const uint32_t first_cluster, const uint32_t end_cluster) {
+	// Best effort - entries stored before a failure are returned to free space
+	uint32_t cluster_id = first_cluster;
+	while (cluster_id < end_cluster) {
+		uint32_t FAT_sector = partition->fat_start_sector + (cluster_id / 128);
+		uint8_t loaded = (FS_SUCCESS == read_buffered_sector(partition->fat_device, FAT_sector));
+		do {
+			if (loaded) memset(&get_raw_buffer(partition->fat_device)[(cluster_id % 128) * 4], 0, sizeof(uint32_t));
+			if (FS_MAP_CLUSTERS == partition->alloc_map_mode) {
+				fat32_map_update(partition->alloc_map, cluster_id, 0);
+			}
+			cluster_id++;
+		} while (cluster_id < end_cluster && cluster_id % 128);
+		if (loaded && FS_SUCCESS == write_buffered_sector(partition->fat_device, FAT_sector)) {
+			fat32_mark_fat_sector(partition, FAT_sector);
+		}
+	}
+}
+
+fs_error fat32_link_cluster_run(fs_partition_t* partition, uint32_t* last_cluster, const uint32_t first_cluster, const uint32_t length) {
 	fs_error err = FS_SUCCESS;
 
+	// Entries are filled one FAT sector at a time - each sector is read and written once
+	uint32_t cluster_id = first_cluster;
+	uint32_t end_cluster = first_cluster + length;
+	while (FS_SUCCESS == err && cluster_id < end_cluster) {
+		uint32_t FAT_sector = partition->fat_start_sector + (cluster_id / 128);
+		err = read_buffered_sector(partition->fat_device, FAT_sector);
+		if (FS_SUCCESS == err) {
+			uint8_t* fat_buff = get_raw_buffer(partition->fat_device);
+			do {
+				uint32_t fat_entry = (cluster_id + 1 < end_cluster) ? cluster_id + 1 : 0x0FFFFFFF;
+				memcpy(&fat_buff[(cluster_id % 128) * 4], &fat_entry, sizeof(uint32_t));
+				if (FS_MAP_CLUSTERS == partition->alloc_map_mode) {
+					fat32_map_update(partition->alloc_map, cluster_id, 1);
+				}
+				cluster_id++;
+			} while (cluster_id < end_cluster && cluster_id % 128);
+			err = write_buffered_sector(partition->fat_device, FAT_sector);
+			if (FS_SUCCESS == err) fat32_mark_fat_sector(partition, FAT_sector);
+		}
+	}
+
+	uint32_t current_FAT_entry = *last_cluster * 4;
+	uint32_t current_FAT_sector = partition->fat_start_sector + (current_FAT_entry / SECTOR_SIZE);
+	uint8_t chain_linked = 0;
+	if (FS_SUCCESS == err && 0 != *last_cluster) {
+		err = read_buffered_sector(partition->fat_device, current_FAT_sector);
+		if (FS_SUCCESS == err) {
+			memcpy(&get_raw_buffer(partition->fat_device)[current_FAT_entry % SECTOR_SIZE], &first_cluster, sizeof(uint32_t));
+			chain_linked = 1;	// Buffer holds the link even if it is not stored
+			err = write_buffered_sector(partition->fat_device, current_FAT_sector);
+			if (FS_SUCCESS == err) fat32_mark_fat_sector(partition, current_FAT_sector);
+		}
+	}
+
+	if (FS_SUCCESS == err) {
+		*last_cluster = end_cluster - 1;
+		partition->next_free = (end_cluster <= partition->cluster_count + 1) ? end_cluster : 2;
+		if (FS_INFO_UNKNOWN != partition->free_count) partition->free_count -= (partition->free_count < length) ? partition->free_count : length;
+		partition->fs_info_dirty = 1;
+	}
+	else {
+		// Run is not left half linked - chain keeps its previous end and written entries are cleared
+		if (chain_linked && FS_SUCCESS == read_buffered_sector(partition->fat_device, current_FAT_sector)) {
+			uint32_t end_of_chain = 0x0FFFFFFF;
+			memcpy(&get_raw_buffer(partition->fat_device)[current_FAT_entry % SECTOR_SIZE], &end_of_chain, sizeof(uint32_t));
+			if (FS_SUCCESS == write_buffered_sector(partition->fat_device, current_FAT_sector)) {
+				fat32_mark_fat_sector(partition, current_FAT_sector);
+			}
+		}
+		fat32_clear_cluster_run(partition, first_cluster, cluster_id);
+	}
+
+	return err;
+}
+
+fs_error fat32_alloc_cluster_run(fs_partition_t* partition, uint32_t* last_cluster, const uint32_t count, uint32_t* first_cluster) {
+	fs_error err = FS_SUCCESS;
+
+	if (FS_INFO_UNKNOWN != partition->free_count && partition->free_count < count) {
+		err = FS_DISK_FULL;		// Known in advance - nothing has to be linked
+	}
+
+	// Volume is searched for contiguous space once - when it is fragmented, following runs are taken in order
+	uint32_t scan_from = (FS_INFO_UNKNOWN == partition->next_free) ? 2 : partition->next_free;
+	uint32_t previous_last = *last_cluster;
+	uint32_t allocated = 0;
+	while (FS_SUCCESS == err && allocated < count) {
+		uint32_t run_start = 0;
+		uint32_t run_length = 0;
+		err = fat32_find_free_run(partition, scan_from, count - allocated, 0 != allocated, &run_start, &run_length);
+		if (FS_SUCCESS == err) {
+			if (run_length > count - allocated) run_length = count - allocated;
+			err = fat32_link_cluster_run(partition, last_cluster, run_start, run_length);
+		}
+		if (FS_SUCCESS == err) {
+			if (0 == allocated) *first_cluster = run_start;
+			allocated += run_length;
+			scan_from = (run_start + run_length <= partition->cluster_count + 1) ? run_start + run_length : 2;
+		}
+	}
+
+	// Do not leave file partially extended - runs linked before the failed one are released again
+	if (FS_SUCCESS != err && allocated) {
+		uint32_t linked = *first_cluster;
+		if (0 != previous_last) {
+			uint32_t previous_FAT_entry = previous_last * 4;
+			uint32_t previous_FAT_sector = partition->fat_start_sector + (previous_FAT_entry / SECTOR_SIZE);
+			if (FS_SUCCESS == read_buffered_sector(partition->fat_device, previous_FAT_sector)) {
+				uint32_t end_of_chain = 0x0FFFFFFF;
+				memcpy(&get_raw_buffer(partition->fat_device)[previous_FAT_entry % SECTOR_SIZE], &end_of_chain, sizeof(uint32_t));
+				if (FS_SUCCESS == write_buffered_sector(partition->fat_device, previous_FAT_sector)) {
+					fat32_mark_fat_sector(partition, previous_FAT_sector);
+				}
+			}
+		}
+		fat32_free_cluster_chain(partition, &linked);
+		*last_cluster = previous_last;
+		*first_cluster = 0;
+	}
+
+	return err;
+}
+
+void fat32_erase_cluster_run(fs_partition_t* partition, const uint32_t first_cluster, const uint32_t length) {
+	if (length) {
+		// Erase is only a hint for the media - chain is released regardless of its result
+		uint32_t sector = fat32_get_cluster_sector(partition, &first_cluster);
+		erase_direct_sectors(partition->device, sector, length * partition->sectors_per_cluster);
+	}
+}
+
+fs_error fat32_erase_freed_runs(fs_partition_t* partition, const uint32_t FAT_sector, fs_sector_range* runs, uint8_t* run_count) {
+	fs_error err = FS_SUCCESS;
+
+	// Released clusters are erased only after FAT sectors which linked them are stored
+	err = write_buffered_sector(partition->fat_device, FAT_sector);
+	if (FS_SUCCESS == err) {
+		err = flush_buffered_sectors(partition->fat_device);
+	}
+	for (uint8_t run = 0; run < *run_count && FS_SUCCESS == err; run++) {
+		fat32_erase_cluster_run(partition, runs[run].first, runs[run].last - runs[run].first + 1);
+	}
+	*run_count = 0;
+
+	return err;
+}
+
+fs_error fat32_free_cluster_chain(fs_partition_t* partition, uint32_t* first_cluster) {
+	fs_error err = FS_SUCCESS;
+
+	fs_sector_range runs[FREED_RUNS];	// First and last cluster of each run
+	uint8_t run_count = 0;
+	uint8_t erase = (NULL != partition->device->erase_sectors);
 	uint32_t next_FAT_entry = *first_cluster;
 	uint32_t current_FAT_entry = next_FAT_entry * 4;
 	uint32_t current_FAT_sector = partition->fat_start_sector + (current_FAT_entry / SECTOR_SIZE);  // counted from zero
 
 	*first_cluster = 0;
+	if (next_FAT_entry < 2) {
+		return err;	// Empty file has no chain
+	}
 
-	while (FS_SUCCESS == err && next_FAT_entry != 0x0fffffff) {
+	while (FS_SUCCESS == err && next_FAT_entry >= 2 && (next_FAT_entry & FAT_ENTRY_MASK) < FAT_END_OF_CHAIN) {
 		
 		current_FAT_entry = next_FAT_entry * 4;
 		current_FAT_sector = partition->fat_start_sector + (current_FAT_entry / SECTOR_SIZE);  // counted from zero
 
-		err = read_buffered_sector(partition->device, current_FAT_sector);
+		err = read_buffered_sector(partition->fat_device, current_FAT_sector);
 		if (err == FS_SUCCESS) {
-			uint8_t* fat_entry_buff = &get_raw_buffer(partition->device)[current_FAT_entry % SECTOR_SIZE];
-			set_pending_write(partition->device);
+			uint8_t* fat_entry_buff = &get_raw_buffer(partition->fat_device)[current_FAT_entry % SECTOR_SIZE];
+			err = set_pending_write(partition->fat_device);
+			fat32_mark_fat_sector(partition, current_FAT_sector);
 			memcpy(&next_FAT_entry, fat_entry_buff, sizeof(uint32_t)); // Copy next cluster to be cleaned
 			memset(fat_entry_buff, 0, sizeof(uint32_t));               // Clear
+			// Consecutive clusters are erased as single extent
+			uint32_t cluster = current_FAT_entry / 4;
+			if (run_count && runs[run_count - 1].last + 1 == cluster) {
+				runs[run_count - 1].last = cluster;
+			}
+			else if (erase && FS_SUCCESS == err) {
+				if (FREED_RUNS == run_count) {
+					err = fat32_erase_freed_runs(partition, current_FAT_sector, runs, &run_count);
+				}
+				runs[run_count].first = cluster;
+				runs[run_count].last = cluster;
+				run_count++;
+			}
+			if (FS_INFO_UNKNOWN != partition->free_count) partition->free_count++;
+			partition->fs_info_dirty = 1;
+			if (FS_MAP_CLUSTERS == partition->alloc_map_mode) {
+				fat32_map_update(partition->alloc_map, current_FAT_entry / 4, 0);
+			}
+			else if (FS_MAP_FAT_SECTORS == partition->alloc_map_mode) {
+				fat32_map_update(partition->alloc_map, current_FAT_entry / SECTOR_SIZE, 0);
+			}
 		}
 	}
 
-	err = write_buffered_sector(partition->device, current_FAT_sector);
+	if (FS_SUCCESS == err && run_count) {
+		err = fat32_erase_freed_runs(partition, current_FAT_sector, runs, &run_count);
+	}
+	else if (FS_SUCCESS == err) {
+		err = write_buffered_sector(partition->fat_device, current_FAT_sector);
+	}
+
+	return err;
+}
+
+fs_error fat32_truncate_cluster_chain(fs_partition_t* partition, const uint32_t last_cluster) {
+	fs_error err = FS_SUCCESS;
+
+	uint32_t next_cluster = last_cluster;
+	err = fat32_find_next_cluster(partition, &next_cluster);
+	if (FS_SUCCESS == err) {
+		// Chain is ended first - failure to release the rest leaks clusters but keeps the file valid
+		uint32_t current_FAT_entry = last_cluster * 4;
+		uint32_t current_FAT_sector = partition->fat_start_sector + (current_FAT_entry / SECTOR_SIZE);
+		err = read_buffered_sector(partition->fat_device, current_FAT_sector);
+		if (FS_SUCCESS == err) {
+			uint32_t end_of_chain = 0x0FFFFFFF;
+			memcpy(&get_raw_buffer(partition->fat_device)[current_FAT_entry % SECTOR_SIZE], &end_of_chain, sizeof(uint32_t));
+			err = write_buffered_sector(partition->fat_device, current_FAT_sector);
+		}
+		if (FS_SUCCESS == err) {
+			fat32_mark_fat_sector(partition, current_FAT_sector);
+			err = fat32_free_cluster_chain(partition, &next_cluster);
+		}
+	}
+	else if (FS_END_OF_CHAIN == err) {
+		err = FS_SUCCESS;	// Nothing follows given cluster
+	}
 
 	return err;
 }
@@ -13,6 +13,34 @@
 #include "../slimfaterr.h"
 #include "../storage/storage.h"
 
+typedef enum {
+	FS_MAP_NONE,
+	FS_MAP_CLUSTERS,	/* Bit per cluster - set when cluster is used */
+	FS_MAP_FAT_SECTORS	/* Bit per FAT sector - set when sector has no free entries */
+} fs_alloc_map_mode;
+
+typedef struct fat32_entry {
+	// Basic file info
+	uint8_t  attributes;
+	uint32_t file_size;
+	uint32_t starting_cluster;
+	// File access variables
+	uint32_t root_dir_cluster;
+	uint16_t root_dir_offset;
+} fat_entry_t;
+
+typedef struct {
+	/* Directory searched, hash of searched name and name as stored in the entry */
+	uint32_t parent_cluster;
+	uint32_t name_hash;
+	uint8_t  short_name[11];
+	/* Found entry - zero root_dir_cluster marks unused slot */
+	fat_entry_t entry;
+} fs_dir_cache_entry;
+
+/* Number of separate ranges of modified FAT sectors remembered for mirroring */
+#define FAT_MIRROR_RANGES 4
+
 typedef struct fs_fat32_partition {
 	// Hardware device on which partition exists
 	fs_storage_device* device;
@@ -22,34 +50,71 @@ typedef struct fs_fat32_partition {
 	uint32_t root_cluster;
 	uint32_t sectors_pre_fat;
 	uint32_t fat_start_sector;
+	uint8_t  num_fats;
 	uint32_t data_start_sector;
+	uint32_t cluster_count;
+	// Allocation hints kept in FSInfo sector
+	uint32_t fs_info_sector;
+	uint32_t free_count;		// FS_INFO_UNKNOWN when not known
+	uint32_t next_free;			// FS_INFO_UNKNOWN when not known
+	uint8_t  fs_info_dirty;
+	// Optional allocation bitmap in caller provided memory
+	uint8_t* alloc_map;
+	uint32_t alloc_map_size;
+	fs_alloc_map_mode alloc_map_mode;
+	// Optional FAT sector cache in caller provided memory - FAT and file data do not evict each other
+	uint8_t* fat_buffer;
+	fs_cache_slot* fat_slots;
+	uint8_t  fat_slot_count;
+	fs_storage_device fat_cache;
+	// Device used for FAT sectors - fat_cache or device
+	fs_storage_device* fat_device;
+	// Optional cache of found directory entries in caller provided memory
+	fs_dir_cache_entry* dir_cache;
+	uint8_t  dir_cache_size;
+	uint8_t  dir_cache_next;
+	// FAT sectors modified since FAT copies were last updated, counted from start of FAT
+	fs_sector_range fat_dirty[FAT_MIRROR_RANGES];
+	uint8_t  fat_dirty_count;
+	// Open file handles with private buffer - their data is stored by fs_sync
+	struct fs_generic_file* buffered_files;
 } fs_partition_t;
 
-typedef struct fat32_entry {
-	// Basic file info
-	uint8_t  attributes;
-	uint32_t file_size;
-	uint32_t starting_cluster;
-	// File access variables
-	uint32_t root_dir_cluster;
-	uint16_t root_dir_offset;
-} fat_entry_t;
+#define FS_INFO_UNKNOWN	0xFFFFFFFF
+
+/* Directory entry attributes */
+#define ATTR_READ_ONLY	0x01
+#define ATTR_HIDDEN		0x02
+#define ATTR_SYSTEM		0x04
+#define ATTR_VOLUME_ID	0x08
+#define ATTR_DIRECTORY	0x10
+#define ATTR_ARCHIVE	0x20
+
+/* Longest short name with dot and terminating zero - "filename.ext" */
+#define FAT_SHORT_NAME_LEN	13
 
 #define GET_PART_HANDLE(dev) {.device = &dev}
+#define GET_ALLOC_MAP_PART_HANDLE(dev, map, size) {.device = &dev, .alloc_map = map, .alloc_map_size = size}
 
 /* Partition operation */
 fs_error fat32_mount_partition(fs_partition_t* partition, const uint32_t start_sector);
+fs_error fat32_sync_fs_info(fs_partition_t* partition);
+fs_error fat32_flush_fat(fs_partition_t* partition);
+fs_error fat32_sync_fat_copies(fs_partition_t* partition);
 
 /* File entry operations */
-fs_error fat32_find_entry(const fs_partition_t* partition, fat_entry_t* file, const uint8_t* name, const uint8_t name_len);
-fs_error fat32_create_entry(const fs_partition_t* partition, fat_entry_t* entry, const uint8_t* name, const uint8_t name_len);
-fs_error fat32_update_entry(const fs_partition_t* partition, fat_entry_t* file);
+fs_error fat32_find_entry(fs_partition_t* partition, fat_entry_t* file, const uint8_t* name, const uint8_t name_len);
+fs_error fat32_create_entry(fs_partition_t* partition, fat_entry_t* entry, const uint8_t* name, const uint8_t name_len);
+fs_error fat32_update_entry(fs_partition_t* partition, fat_entry_t* file);
+fs_error fat32_read_dir_entry(fs_partition_t* partition, uint32_t* dir_cluster, uint16_t* dir_offset, fat_entry_t* entry, uint8_t* name);
 
 /* Cluster operations */
 uint32_t fat32_get_cluster_sector(const fs_partition_t* partition, const uint32_t* cluster);
 
 fs_error fat32_find_next_cluster(const fs_partition_t* partition, uint32_t* cluster);
-fs_error fat32_alloc_new_cluster(const fs_partition_t* partition, uint32_t* last_cluster);
-fs_error fat32_free_cluster_chain(const fs_partition_t* partition, uint32_t* first_cluster);
+fs_error fat32_alloc_new_cluster(fs_partition_t* partition, uint32_t* last_cluster, const uint8_t is_directory);
+fs_error fat32_alloc_cluster_run(fs_partition_t* partition, uint32_t* last_cluster, const uint32_t count, uint32_t* first_cluster);
+fs_error fat32_free_cluster_chain(fs_partition_t* partition, uint32_t* first_cluster);
+fs_error fat32_truncate_cluster_chain(fs_partition_t* partition, const uint32_t last_cluster);
 
 #endif
\ No newline at end of file
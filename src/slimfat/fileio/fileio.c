@@ -3,6 +3,12 @@
 #include <stddef.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #define EOL_CR_CHAR	'\r'
 #define EOL_LF_CHAR	'\n'
 
@@ -11,6 +17,10 @@ uint8_t end_of_cluster(fs_file_t* file) {
 	return (left || !file->current_offset); // zero on success
 }
 
+uint32_t get_cluster_size(const fs_file_t* file) {
+	return (uint32_t)file->partition->sectors_per_cluster * SECTOR_SIZE;
+}
+
 uint32_t get_file_left_bytes(const fs_file_t* file) {
 	return file->entry.file_size - file->current_offset;
 }
@@ -19,40 +29,543 @@ uint16_t get_offset_in_sector(fs_file_t* file) {
 	return file->current_offset % SECTOR_SIZE;
 }
 
-fs_error read_file_buffer(fs_file_t* file) {
+uint32_t get_file_sector(fs_file_t* file) {
 	uint32_t sector = fat32_get_cluster_sector(file->partition, &file->current_cluster);
-	sector += (file->current_offset % (file->partition->sectors_per_cluster * SECTOR_SIZE)) / SECTOR_SIZE;
-	return read_buffered_sector(file->partition->device, sector);
+	return sector + (file->current_offset % (file->partition->sectors_per_cluster * SECTOR_SIZE)) / SECTOR_SIZE;
+}
+
+uint8_t file_buffer_holds(const fs_file_t* file, const uint32_t sector) {
+	return (file->buffer_slot.status & SLOT_VALID) && file->buffer_slot.sector == sector;
+}
+
+fs_error flush_file_buffer(fs_file_t* file) {
+	fs_error err = FS_SUCCESS;
+
+	if (file->buffer && (file->buffer_slot.status & SLOT_DIRTY)) {
+		err = write_direct_sectors(file->partition->device, file->buffer_slot.sector, 1, file->buffer);
+		if (FS_SUCCESS == err) {
+			file->buffer_slot.status &= ~SLOT_DIRTY;
+		}
+	}
+
+	return err;
+}
+
+void unlink_buffered_file(fs_file_t* file) {
+	fs_file_t** link = &file->partition->buffered_files;
+	while (NULL != *link && file != *link) {
+		link = &(*link)->next_buffered;
+	}
+	if (NULL != *link) {
+		*link = file->next_buffered;
+	}
+}
+
+fs_error check_buffered_sharing(const fs_file_t* file, const fs_mode mode) {
+	fs_error err = FS_SUCCESS;
+
+	// Private buffer is not coherent with other handles - file open through it is written by no other handle
+	for (const fs_file_t* open = file->partition->buffered_files; NULL != open && FS_SUCCESS == err; open = open->next_buffered) {
+		if (open != file && open->entry.root_dir_cluster == file->entry.root_dir_cluster && open->entry.root_dir_offset == file->entry.root_dir_offset) {
+			if (READ != open->mode || READ != mode) {
+				err = FS_FILE_ACCES_FAIL;
+			}
+		}
+	}
+
+	return err;
+}
+
+fs_error read_file_buffer(fs_file_t* file) {
+	fs_error err = FS_SUCCESS;
+
+	uint32_t sector = get_file_sector(file);
+	if (NULL == file->buffer) {
+		err = read_buffered_sector(file->partition->device, sector);
+	}
+	else if (file_buffer_holds(file, sector)) {
+		FS_STATS_INC(buffer_hits);
+	}
+	else {
+		err = flush_file_buffer(file);
+		if (FS_SUCCESS == err) {
+			// Shared cache overlays sectors modified through handles without private buffer
+			err = read_direct_sectors(file->partition->device, sector, 1, file->buffer);
+		}
+		file->buffer_slot.sector = sector;
+		file->buffer_slot.status = (FS_SUCCESS == err) ? SLOT_VALID : 0;
+	}
+
+	return err;
+}
+
+fs_error load_write_buffer(fs_file_t* file) {
+	fs_error err = FS_SUCCESS;
+
+	// Sector starting at end of file holds no file data - it is zero padded instead of being read
+	if (0 == get_offset_in_sector(file) && file->current_offset >= file->entry.file_size) {
+		uint32_t sector = get_file_sector(file);
+		if (NULL == file->buffer) {
+			err = clear_buffered_sector(file->partition->device, sector);
+		}
+		else {
+			if (!file_buffer_holds(file, sector)) {
+				err = flush_file_buffer(file);
+			}
+			if (FS_SUCCESS == err) {
+				memset(file->buffer, 0, SECTOR_SIZE);
+				file->buffer_slot.sector = sector;
+				file->buffer_slot.status = SLOT_VALID | SLOT_DIRTY;
+			}
+		}
+	}
+	else {
+		err = read_file_buffer(file);
+	}
+
+	return err;
 }
 
 uint8_t* get_file_buffer(fs_file_t* file) {
+	if (file->buffer) return file->buffer;
 	return get_raw_buffer(file->partition->device);
 }
 
-uint8_t find_eol_sequence(const  uint8_t* buff, uint16_t* count) {
-	uint8_t match = 0;
+fs_error set_file_pending_write(fs_file_t* file) {
+	fs_error err = FS_SUCCESS;
 
-	static uint8_t partial_match;
-	uint16_t res = 0;
-	for (uint16_t i = 0; (i < *count) && !match; i++) {
-		if (buff[i] == EOL_CR_CHAR) {
-			partial_match = 1;
+	if (file->buffer) file->buffer_slot.status |= SLOT_DIRTY;
+	else err = set_pending_write(file->partition->device);
+
+	return err;
+}
+
+uint32_t get_cached_clusters(const fs_file_t* file) {
+	uint32_t cached = 0;
+	if (file->extent_count) {
+		const fs_extent_t* last = &file->extents[file->extent_count - 1];
+		cached = last->file_cluster + last->length;
+	}
+	return cached;
+}
+
+void cache_file_cluster(fs_file_t* file, const uint32_t index, const uint32_t cluster) {
+	// Only runs directly following cached part of the chain are stored
+	if (file->extent_slots && index == get_cached_clusters(file)) {
+		fs_extent_t* last = file->extent_count ? &file->extents[file->extent_count - 1] : NULL;
+		if (last && last->disk_cluster + last->length == cluster) {
+			last->length++;
 		}
-		else if (buff[i] == EOL_LF_CHAR && partial_match == 1) {
-			partial_match = 2;
-			match = 1;
+		else if (file->extent_count < file->extent_slots) {
+			fs_extent_t* extent = &file->extents[file->extent_count++];
+			extent->file_cluster = index;
+			extent->disk_cluster = cluster;
+			extent->length = 1;
 		}
-		else {
-			partial_match = 0;
+	}
+}
+
+uint32_t find_cached_cluster(const fs_file_t* file, const uint32_t index) {
+	uint8_t first = 0;
+	uint8_t last = file->extent_count - 1;
+	while (first < last) {
+		uint8_t middle = (first + last + 1) / 2;
+		if (file->extents[middle].file_cluster <= index) first = middle;
+		else last = middle - 1;
+	}
+	return file->extents[first].disk_cluster + (index - file->extents[first].file_cluster);
+}
+
+fs_error seek_file_cluster(fs_file_t* file, const uint32_t index, uint32_t* cluster) {
+	fs_error err = FS_SUCCESS;
+
+	if (file->extent_slots && 0 == file->extent_count && 0 != file->entry.starting_cluster) {
+		cache_file_cluster(file, 0, file->entry.starting_cluster);
+	}
+
+	uint32_t cached = get_cached_clusters(file);
+	if (index < cached) {
+		*cluster = find_cached_cluster(file, index);
+	}
+	else {
+		// Walk chain from the nearest known cluster - end of cached runs, current position or first cluster
+		uint32_t known_index = 0;
+		uint32_t known_cluster = file->entry.starting_cluster;
+		if (cached) {
+			known_index = cached - 1;
+			known_cluster = find_cached_cluster(file, known_index);
+		}
+		uint32_t current_index = file->current_offset ? (file->current_offset - 1) / get_cluster_size(file) : 0;
+		if (0 != file->current_cluster && current_index <= index && current_index > known_index) {
+			known_index = current_index;
+			known_cluster = file->current_cluster;
+		}
+		while (FS_SUCCESS == err && known_index < index) {
+			err = fat32_find_next_cluster(file->partition, &known_cluster);
+			if (FS_SUCCESS == err) {
+				cache_file_cluster(file, ++known_index, known_cluster);
+			}
+		}
+		if (FS_SUCCESS == err) {
+			*cluster = known_cluster;
 		}
-		res++;
 	}
-	*count = res;
 
-	return match;
+	return err;
+}
+
+fs_error next_read_cluster(fs_file_t* file) {
+	uint32_t next_cluster = 0;
+	fs_error err = seek_file_cluster(file, file->current_offset / get_cluster_size(file), &next_cluster);
+	if (FS_SUCCESS == err) {
+		file->current_cluster = next_cluster;
+	}
+	return err;
+}
+
+fs_error next_write_cluster(fs_file_t* file) {
+	fs_error err = FS_SUCCESS;
+
+	if (0 == file->entry.starting_cluster) {
+		// Allocate first cluster for empty file
+		err = fat32_alloc_new_cluster(file->partition, &file->entry.starting_cluster, 0);
+		file->current_cluster = file->entry.starting_cluster;
+		file->extent_count = 0;
+	}
+	else if (!end_of_cluster(file)) {
+		// Clusters reserved by fs_fallocate are used before new ones are allocated
+		uint32_t next_cluster = file->current_cluster;
+		err = fat32_find_next_cluster(file->partition, &next_cluster);
+		if (FS_SUCCESS == err) {
+			file->current_cluster = next_cluster;
+		}
+		else if (FS_END_OF_CHAIN == err) {
+			err = fat32_alloc_new_cluster(file->partition, &file->current_cluster, 0);
+		}
+		if (FS_SUCCESS == err) {
+			cache_file_cluster(file, file->current_offset / get_cluster_size(file), file->current_cluster);
+		}
+	}
+
+	return err;
+}
+
+fs_error follow_file_cluster(fs_file_t* file, const uint32_t index, uint32_t* cluster) {
+	fs_error err = FS_SUCCESS;
+
+	// Cluster following given one - taken from cached runs when possible
+	if (index + 1 < get_cached_clusters(file)) {
+		*cluster = find_cached_cluster(file, index + 1);
+	}
+	else {
+		err = fat32_find_next_cluster(file->partition, cluster);
+		if (FS_SUCCESS == err) {
+			cache_file_cluster(file, index + 1, *cluster);
+		}
+	}
+
+	return err;
+}
+
+fs_error read_file_sectors(fs_file_t* file, uint8_t* ptr, const uint32_t sectors, uint32_t* read) {
+	fs_error err = FS_SUCCESS;
+
+	// Sector aligned position - run of whole sectors ends with the cluster or the request
+	uint32_t wanted = (sectors < UINT16_MAX) ? sectors : UINT16_MAX;
+	uint32_t cluster_size = get_cluster_size(file);
+	uint32_t index = file->current_offset / cluster_size;
+	uint32_t last_cluster = file->current_cluster;
+	uint32_t run = file->partition->sectors_per_cluster - (file->current_offset % cluster_size) / SECTOR_SIZE;
+
+	// Run continues into following clusters as long as they are consecutive on disk
+	while (run < wanted) {
+		uint32_t next_cluster = last_cluster;
+		if (FS_SUCCESS != follow_file_cluster(file, index, &next_cluster) || next_cluster != last_cluster + 1) {
+			break;	// Chain is followed again by regular path
+		}
+		last_cluster = next_cluster;
+		index++;
+		run += file->partition->sectors_per_cluster;
+	}
+	if (run > wanted) run = wanted;
+
+	uint32_t first_sector = get_file_sector(file);
+	err = read_direct_sectors(file->partition->device, first_sector, run, ptr);
+	if (FS_SUCCESS == err) {
+		// Private buffer may hold data not yet stored on the device
+		if ((file->buffer_slot.status & SLOT_VALID) && file->buffer_slot.sector >= first_sector && file->buffer_slot.sector - first_sector < run) {
+			memcpy(&ptr[(file->buffer_slot.sector - first_sector) * SECTOR_SIZE], file->buffer, SECTOR_SIZE);
+		}
+		*read = run * SECTOR_SIZE;
+		file->current_offset += *read;
+		file->current_cluster = last_cluster;	// Holds last sector read
+	}
+
+	return err;
+}
+
+fs_error write_file_sectors(fs_file_t* file, const uint8_t* ptr, const uint32_t sectors, uint32_t* written) {
+	fs_error err = FS_SUCCESS;
+
+	// Same as read_file_sectors - missing clusters are allocated while looking for consecutive ones
+	uint32_t wanted = (sectors < UINT16_MAX) ? sectors : UINT16_MAX;
+	uint32_t cluster_size = get_cluster_size(file);
+	uint32_t index = file->current_offset / cluster_size;
+	uint32_t last_cluster = file->current_cluster;
+	uint32_t run = file->partition->sectors_per_cluster - (file->current_offset % cluster_size) / SECTOR_SIZE;
+
+	while (run < wanted) {
+		uint32_t next_cluster = last_cluster;
+		fs_error next_err = follow_file_cluster(file, index, &next_cluster);
+		if (FS_END_OF_CHAIN == next_err) {
+			next_err = fat32_alloc_new_cluster(file->partition, &next_cluster, 0);
+			if (FS_SUCCESS == next_err) {
+				cache_file_cluster(file, index + 1, next_cluster);
+			}
+		}
+		if (FS_SUCCESS != next_err || next_cluster != last_cluster + 1) {
+			break;	// Cluster linked to chain is picked up by next_write_cluster
+		}
+		last_cluster = next_cluster;
+		index++;
+		run += file->partition->sectors_per_cluster;
+	}
+	if (run > wanted) run = wanted;
+
+	uint32_t first_sector = get_file_sector(file);
+	err = write_direct_sectors(file->partition->device, first_sector, run, ptr);
+	if (FS_SUCCESS == err) {
+		// Keep private copy of overwritten sector up to date
+		if ((file->buffer_slot.status & SLOT_VALID) && file->buffer_slot.sector >= first_sector && file->buffer_slot.sector - first_sector < run) {
+			memcpy(file->buffer, &ptr[(file->buffer_slot.sector - first_sector) * SECTOR_SIZE], SECTOR_SIZE);
+			file->buffer_slot.status = SLOT_VALID;
+		}
+		*written = run * SECTOR_SIZE;
+		file->current_offset += *written;
+		file->current_cluster = last_cluster;	// Holds last sector written
+	}
+
+	return err;
+}
+
+typedef struct {
+	const fs_iovec_t* iov;				// Segments filled by reading
+	const fs_const_iovec_t* const_iov;	// Segments stored by writing
+	uint16_t iovcnt;
+	uint16_t segment;	// Current segment
+	uint32_t offset;	// Bytes of current segment already transferred
+} fs_iovec_cursor;
+
+uint32_t iovec_length(const fs_iovec_cursor* cursor, const uint16_t segment) {
+	return cursor->iov ? cursor->iov[segment].length : cursor->const_iov[segment].length;
+}
+
+uint32_t iovec_total(const fs_iovec_cursor* cursor) {
+	uint32_t total = 0;
+	for (uint16_t i = 0; i < cursor->iovcnt; i++) {
+		total += iovec_length(cursor, i);
+	}
+	return total;
+}
+
+uint32_t iovec_left(fs_iovec_cursor* cursor) {
+	// Exhausted and empty segments are skipped
+	while (cursor->segment < cursor->iovcnt && cursor->offset == iovec_length(cursor, cursor->segment)) {
+		cursor->segment++;
+		cursor->offset = 0;
+	}
+	return (cursor->segment < cursor->iovcnt) ? iovec_length(cursor, cursor->segment) - cursor->offset : 0;
+}
+
+uint8_t* iovec_read_base(const fs_iovec_cursor* cursor) {
+	return &cursor->iov[cursor->segment].base[cursor->offset];
+}
+
+const uint8_t* iovec_write_base(const fs_iovec_cursor* cursor) {
+	return &cursor->const_iov[cursor->segment].base[cursor->offset];
+}
+
+void iovec_scatter(fs_iovec_cursor* cursor, const uint8_t* data, const uint16_t count) {
+	// Sector data is split between as many segments as needed
+	uint16_t copied = 0;
+	while (copied < count) {
+		uint32_t left = iovec_left(cursor);
+		uint16_t chunk = (left < (uint32_t)(count - copied)) ? left : count - copied;
+		memcpy(iovec_read_base(cursor), &data[copied], chunk);
+		cursor->offset += chunk;
+		copied += chunk;
+	}
+}
+
+void iovec_gather(fs_iovec_cursor* cursor, uint8_t* data, const uint16_t count) {
+	// Sector data is gathered from as many segments as needed
+	uint16_t copied = 0;
+	while (copied < count) {
+		uint32_t left = iovec_left(cursor);
+		uint16_t chunk = (left < (uint32_t)(count - copied)) ? left : count - copied;
+		memcpy(&data[copied], iovec_write_base(cursor), chunk);
+		cursor->offset += chunk;
+		copied += chunk;
+	}
+}
+
+fs_error read_file_data(fs_file_t* file, fs_iovec_cursor* cursor, const uint32_t count, uint32_t* read) {
+	fs_error err = FS_SUCCESS;
+
+	uint32_t bytes_left = count;
+	uint32_t file_left = get_file_left_bytes(file);
+	while (FS_SUCCESS == err && bytes_left && file_left) {
+		if (!end_of_cluster(file)) {
+			err = next_read_cluster(file);
+		}
+		uint32_t segment_left = iovec_left(cursor);
+		uint32_t bytes_wanted = (segment_left < file_left) ? segment_left : file_left;
+		if (FS_SUCCESS == err && 0 == get_offset_in_sector(file) && bytes_wanted >= SECTOR_SIZE) {
+			// Read whole sectors directly into user buffer
+			uint32_t bytes_read = 0;
+			err = read_file_sectors(file, iovec_read_base(cursor), bytes_wanted / SECTOR_SIZE, &bytes_read);
+			if (FS_SUCCESS == err) {
+				cursor->offset += bytes_read;
+				bytes_left -= bytes_read;
+				file_left -= bytes_read;
+			}
+		}
+		else if (FS_SUCCESS == err) {
+			err = read_file_buffer(file);
+			if (FS_SUCCESS == err) {
+				// Calculate bytes to copy from current sector
+				uint16_t sector_offset = get_offset_in_sector(file);
+				uint16_t bytes_to_copy = SECTOR_SIZE - sector_offset;
+				if (bytes_to_copy > file_left) bytes_to_copy = file_left;
+				if (bytes_to_copy > bytes_left) bytes_to_copy = bytes_left;
+
+				uint8_t* buffer = get_file_buffer(file);
+				iovec_scatter(cursor, &buffer[sector_offset], bytes_to_copy);
+
+				bytes_left -= bytes_to_copy;
+				file_left -= bytes_to_copy;
+				file->current_offset += bytes_to_copy;
+			}
+		}
+	}
+	*read = count - bytes_left;
+	if (*read) {
+		file->eol_state = 0;	// CR seen by fs_fgets no longer precedes current position
+	}
+
+	return err;
 }
 
+fs_error write_file_data(fs_file_t* file, fs_iovec_cursor* cursor, const uint32_t count, uint32_t* written) {
+	fs_error err = FS_SUCCESS;
+
+	uint32_t bytes_left = count;
+	while (FS_SUCCESS == err && bytes_left) {
+		err = next_write_cluster(file);
+		uint32_t segment_left = iovec_left(cursor);
+		if (FS_SUCCESS == err && 0 == get_offset_in_sector(file) && segment_left >= SECTOR_SIZE) {
+			// Whole sectors are written directly from user buffer - nothing is read first
+			uint32_t bytes_written = 0;
+			err = write_file_sectors(file, iovec_write_base(cursor), segment_left / SECTOR_SIZE, &bytes_written);
+			if (FS_SUCCESS == err) {
+				cursor->offset += bytes_written;
+				bytes_left -= bytes_written;
+			}
+		}
+		else if (FS_SUCCESS == err) {
+			// Partial head or tail sector is staged in device buffer - also when it is gathered from several segments
+			err = load_write_buffer(file);
+			if (FS_SUCCESS == err) {
+				err = set_file_pending_write(file);
+			}
+			if (FS_SUCCESS == err) {
+				// Calculate bytes to copy to current sector
+				uint16_t sector_offset = get_offset_in_sector(file);
+				uint16_t bytes_to_copy = SECTOR_SIZE - sector_offset;
+				if (bytes_to_copy > bytes_left) bytes_to_copy = bytes_left;
+
+				uint8_t* buffer = get_file_buffer(file);
+				iovec_gather(cursor, &buffer[sector_offset], bytes_to_copy);
+
+				bytes_left -= bytes_to_copy;
+				file->current_offset += bytes_to_copy;
+			}
+		}
+		// Data written after fs_fseek may overwrite part of the file instead of extending it
+		if (file->current_offset > file->entry.file_size) {
+			file->entry.file_size = file->current_offset;
+		}
+	}
+	*written = count - bytes_left;
+	if (*written) {
+		file->eol_state = 0;
+	}
+
+	return err;
+}
+
+fs_error flush_partition_sectors(fs_partition_t* partition) {
+	// FAT goes first - directory entries must not point to chains not yet stored
+	fs_error err = fat32_flush_fat(partition);
+	fs_error data_err = flush_buffered_sectors(partition->device);
+	if (FS_SUCCESS == err) {
+		err = data_err;
+	}
+	return err;
+}
+
+uint16_t find_byte(const uint8_t* buff, const uint16_t count, const uint8_t byte) {
+	uint16_t i = 0;
+
+#if defined(__SSE2__)
+	// Host builds - compare 16 bytes at once
+	__m128i pattern = _mm_set1_epi8((char)byte);
+	for (; i + 16 <= count; i += 16) {
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)&buff[i]), pattern));
+		if (mask) return i + __builtin_ctz(mask);
+	}
+#elif defined(__ARM_NEON)
+	uint8x16_t pattern = vdupq_n_u8(byte);
+	for (; i + 16 <= count; i += 16) {
+		uint8x16_t equal = vceqq_u8(vld1q_u8(&buff[i]), pattern);
+		// Narrow every compared byte to a nibble of 64 bit mask
+		uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)), 0);
+		if (mask) return i + (__builtin_ctzll(mask) >> 2);
+	}
+#elif UINTPTR_MAX > 0xFFFF
+	// 32 bit MCUs - word containing searched byte has zero byte after XOR with pattern
+	uint32_t pattern = 0x01010101UL * byte;
+	for (; i + sizeof(uint32_t) <= count; i += sizeof(uint32_t)) {
+		uint32_t word;
+		memcpy(&word, &buff[i], sizeof(uint32_t));
+		word ^= pattern;
+		if ((word - 0x01010101UL) & ~word & 0x80808080UL) break;	// Exact position found below
+	}
+#endif
+	while (i < count && buff[i] != byte) i++;
+
+	return i;	// count when byte is not present
+}
+
+uint8_t find_eol_sequence(fs_file_t* file, const uint8_t* buff, uint16_t* count) {
+	uint8_t match = 0;
+
+	const uint8_t eol_char = (FS_EOL_CR == file->eol_mode) ? EOL_CR_CHAR : EOL_LF_CHAR;
+	uint16_t res = 0;
+	while (res < *count && !match) {
+		res += find_byte(&buff[res], *count - res, eol_char);
+		if (res < *count) {
+			// CR of CR LF pair may be the last byte of previous chunk
+			uint8_t after_cr = res ? (EOL_CR_CHAR == buff[res - 1]) : file->eol_state;
+			match = (FS_EOL_CRLF != file->eol_mode) || after_cr;
+			res++;
+		}
+	}
+	if (res) file->eol_state = (EOL_CR_CHAR == buff[res - 1]);
+	*count = res;
 
+	return match;
+}
 
 fs_error fs_mount(fs_partition_t* partition, const uint8_t partition_number) {
 	fs_error err = FS_SUCCESS;
@@ -64,10 +577,52 @@ fs_error fs_mount(fs_partition_t* partition, const uint8_t partition_number) {
 	return err;
 }
 
+fs_error fs_sync(fs_partition_t* partition) {
+	fs_error err = FS_SUCCESS;
+
+	// Private buffers of open handles are stored like sectors of shared cache
+	for (fs_file_t* file = partition->buffered_files; NULL != file; file = file->next_buffered) {
+		if (FS_SUCCESS != flush_file_buffer(file)) {
+			err = FS_WRITE_FAIL;
+		}
+	}
+	fs_error info_err = fat32_sync_fs_info(partition);
+	fs_error mirror_err = fat32_sync_fat_copies(partition);
+	fs_error flush_err = flush_partition_sectors(partition);	// Store file data even if FSInfo or FAT copies fail
+	if (FS_SUCCESS == err) {
+		err = info_err;
+	}
+	if (FS_SUCCESS == err) {
+		err = mirror_err;
+	}
+	if (FS_SUCCESS == err) {
+		err = flush_err;
+	}
+
+	return err;
+}
+
+fs_error fs_umount(fs_partition_t* partition) {
+	return fs_sync(partition);
+}
+
 fs_error fs_fopen(fs_file_t* file, const char* file_name, const fs_mode mode) {
 	fs_error err = FS_SUCCESS;
 
+	if (file->buffer) {
+		// Handle reused without fs_fclose must not lose data modified in its buffer
+		err = flush_file_buffer(file);
+		if (FS_SUCCESS != err) {
+			return err;
+		}
+		unlink_buffered_file(file);
+	}
+
 	file->mode = mode;
+	file->extent_count = 0;
+	file->reserved = 0;
+	file->buffer_slot.status = 0;
+	file->eol_state = 0;
 	file->entry.starting_cluster = file->partition->root_cluster;    // search from root directory
 
 	uint8_t offset = 0;
@@ -87,6 +642,9 @@ fs_error fs_fopen(fs_file_t* file, const char* file_name, const fs_mode mode) {
 			// File access
 			length = strlen(current);
 			err = fat32_find_entry(file->partition, &file->entry, current, length);
+			if (FS_SUCCESS == err) {
+				err = check_buffered_sharing(file, mode);
+			}
 			if (FS_SUCCESS == err) {
 				if (READ == mode) {
 					file->current_cluster = file->entry.starting_cluster;
@@ -94,119 +652,176 @@ fs_error fs_fopen(fs_file_t* file, const char* file_name, const fs_mode mode) {
 				}
 				else if (WRITE == mode) {
 					fat32_free_cluster_chain(file->partition, &file->entry.starting_cluster);
+					file->extent_count = 0;
 					file->current_cluster = 0;
 					file->current_offset = 0;
 					file->entry.file_size = 0;
 				}
 				else if (APPEND == mode) {
 					file->current_cluster = file->entry.starting_cluster;
+					file->current_offset = 0;
 					fs_fseek(file, file->entry.file_size, FS_SEEK_SET);
 				}
 			}
 			else if (FS_FILE_NOT_FOUND == err && WRITE == mode) {
 				err = fat32_create_entry(file->partition, &file->entry, current, length);
+				file->current_cluster = 0;
+				file->current_offset = 0;
 			}
 		}
 	} while (FS_SUCCESS == err && NULL != next);
 
+	if (FS_SUCCESS == err && file->buffer) {
+		file->next_buffered = file->partition->buffered_files;
+		file->partition->buffered_files = file;
+	}
+
 	return err;
 }
 
-fs_error fs_fclose(fs_file_t* file) {
-	uint8_t err = FS_SUCCESS;
+fs_error release_reserved_clusters(fs_file_t* file) {
+	fs_error err = FS_SUCCESS;
 
-	if (READ != file->mode) {
-		err = fat32_update_entry(file->partition, &file->entry);
+	// Clusters reserved by fs_fallocate and not filled with data do not outlive the handle
+	uint32_t cluster_size = get_cluster_size(file);
+	uint32_t kept = file->entry.file_size / cluster_size + (0 != file->entry.file_size % cluster_size);
+	if (0 == kept) {
+		err = fat32_free_cluster_chain(file->partition, &file->entry.starting_cluster);
+		file->current_cluster = 0;
+	}
+	else {
+		uint32_t last_cluster = 0;
+		err = seek_file_cluster(file, kept - 1, &last_cluster);
+		if (FS_SUCCESS == err) {
+			err = fat32_truncate_cluster_chain(file->partition, last_cluster);
+		}
+	}
+	file->extent_count = 0;
+	if (FS_SUCCESS == err) {
+		file->reserved = 0;
 	}
 
 	return err;
 }
 
-fs_error fs_fflush(fs_file_t* file) {
+fs_error fs_fclose(fs_file_t* file) {
 	uint8_t err = FS_SUCCESS;
 
 	if (READ != file->mode) {
-		err = fat32_update_entry(file->partition, &file->entry);
+		err = flush_file_buffer(file);
+		if (FS_SUCCESS == err && file->reserved) {
+			err = release_reserved_clusters(file);
+		}
+		if (FS_SUCCESS == err) {
+			err = fat32_update_entry(file->partition, &file->entry);
+		}
+		if (FS_SUCCESS == err) {
+			err = flush_partition_sectors(file->partition);
+		}
+	}
+	if (FS_SUCCESS == err && file->buffer) {
+		unlink_buffered_file(file);	// Handle which failed to close stays reachable by fs_sync
 	}
 
 	return err;
 }
 
-uint16_t fs_fread(fs_file_t* file, uint8_t* ptr, const uint16_t count) {
+fs_error fs_fflush(fs_file_t* file) {
 	uint8_t err = FS_SUCCESS;
 
 	if (READ != file->mode) {
-		err = FS_FILE_ACCES_FAIL;
-	}
-
-	uint16_t bytes_left = count;
-	uint32_t file_left = get_file_left_bytes(file);
-	while (FS_SUCCESS == err && bytes_left && file_left) {
-		if (!end_of_cluster(file)) {
-			err = fat32_find_next_cluster(file->partition, &file->current_cluster);
+		err = flush_file_buffer(file);
+		if (FS_SUCCESS == err) {
+			err = fat32_update_entry(file->partition, &file->entry);
 		}
 		if (FS_SUCCESS == err) {
-			err = read_file_buffer(file);
-			if (FS_SUCCESS == err) {
-				// Calculate bytes to copy from current sector
-				uint16_t sector_offset = get_offset_in_sector(file);
-				uint16_t bytes_to_copy = SECTOR_SIZE - sector_offset;
-				if (bytes_to_copy > file_left) bytes_to_copy = file_left;
-				if (bytes_to_copy > bytes_left) bytes_to_copy = bytes_left;
+			err = flush_partition_sectors(file->partition);
+		}
+	}
 
-				uint8_t* buffer = get_file_buffer(file);
-				memcpy(&ptr[(count - bytes_left)], &buffer[sector_offset], bytes_to_copy);
+	return err;
+}
 
-				bytes_left -= bytes_to_copy;
-				file_left -= bytes_to_copy;
-				file->current_offset += bytes_to_copy;
+fs_error fs_opendir(fs_dir_t* dir, const char* dir_name) {
+	fs_error err = FS_SUCCESS;
+
+	fat_entry_t entry;
+	entry.starting_cluster = dir->partition->root_cluster;    // search from root directory
+	entry.attributes = ATTR_DIRECTORY;
+
+	const char* current = dir_name;
+	while (FS_SUCCESS == err && '\0' != *current) {
+		const char* next = strpbrk(current, "/");
+		uint8_t length = (NULL != next) ? (uint8_t)(next - current) : (uint8_t)strlen(current);
+		if (length) {
+			err = fat32_find_entry(dir->partition, &entry, current, length);
+			if (FS_SUCCESS == err && !(entry.attributes & ATTR_DIRECTORY)) {
+				err = FS_FILE_ACCES_FAIL;
+			}
+			else if (FS_SUCCESS == err && 0 == entry.starting_cluster) {
+				entry.starting_cluster = dir->partition->root_cluster;	// ".." of first level directory
 			}
 		}
+		current += length;
+		if ('/' == *current) current++;
 	}
 
-	return (count - bytes_left);
+	dir->dir_cluster = (FS_SUCCESS == err) ? entry.starting_cluster : 0;
+	dir->dir_offset = 0;
+
+	return err;
+}
+
+fs_error fs_readdir(fs_dir_t* dir, fs_dirent_t* dirent) {
+	return fat32_read_dir_entry(dir->partition, &dir->dir_cluster, &dir->dir_offset, &dirent->entry, (uint8_t*)dirent->name);
 }
 
-uint16_t fs_fwrite(fs_file_t* file, const uint8_t* ptr, const uint16_t count){
+fs_error fs_closedir(fs_dir_t* dir) {
+	dir->dir_cluster = 0;	// Listing holds no other resources
+	dir->dir_offset = 0;
+	return FS_SUCCESS;
+}
+
+uint32_t fs_fread(fs_file_t* file, uint8_t* ptr, const uint32_t count) {
+	fs_iovec_t iov = { .base = ptr, .length = count };
+	return fs_freadv(file, &iov, 1);
+}
+
+uint32_t fs_freadv(fs_file_t* file, const fs_iovec_t* iov, const uint16_t iovcnt) {
 	uint8_t err = FS_SUCCESS;
-	uint16_t bytes_left = count;
+	uint32_t read = 0;
 
-	if (READ == file->mode) {
+	if (READ != file->mode) {
 		err = FS_FILE_ACCES_FAIL;
 	}
 
-	// Allocate first cluster for empty file
-	if (0 == file->entry.file_size) {
-		fat32_alloc_new_cluster(file->partition, &file->entry.starting_cluster);
-		file->current_cluster = file->entry.starting_cluster;
+	if (FS_SUCCESS == err) {
+		fs_iovec_cursor cursor = { .iov = iov, .iovcnt = iovcnt };
+		err = read_file_data(file, &cursor, iovec_total(&cursor), &read);
 	}
 
-	while (FS_SUCCESS == err && bytes_left) {
-		if (!end_of_cluster(file)) {
-			fat32_alloc_new_cluster(file->partition, &file->current_cluster);
-		}
-		if (FS_SUCCESS == err) {
-			err = read_file_buffer(file);
-			if (FS_SUCCESS == err) {
-				set_pending_write(file->partition->device);
+	return read;
+}
 
-				// Calculate bytes to copy to current sector
-				uint16_t sector_offset = get_offset_in_sector(file);
-				uint16_t bytes_to_copy = SECTOR_SIZE - sector_offset;
-				if (bytes_to_copy > bytes_left) bytes_to_copy = bytes_left;
+uint32_t fs_fwrite(fs_file_t* file, const uint8_t* ptr, const uint32_t count){
+	fs_const_iovec_t iov = { .base = ptr, .length = count };
+	return fs_fwritev(file, &iov, 1);
+}
 
-				uint8_t* buffer = get_file_buffer(file);
-				memcpy(&buffer[sector_offset], &ptr[(count - bytes_left)], bytes_to_copy);
+uint32_t fs_fwritev(fs_file_t* file, const fs_const_iovec_t* iov, const uint16_t iovcnt) {
+	uint8_t err = FS_SUCCESS;
+	uint32_t written = 0;
 
-				bytes_left -= bytes_to_copy;
-				file->entry.file_size += bytes_to_copy;
-				file->current_offset += bytes_to_copy;
-			}
-			
-		}
+	if (READ == file->mode) {
+		err = FS_FILE_ACCES_FAIL;
+	}
+
+	if (FS_SUCCESS == err) {
+		fs_iovec_cursor cursor = { .const_iov = iov, .iovcnt = iovcnt };
+		err = write_file_data(file, &cursor, iovec_total(&cursor), &written);
 	}
 
-	return (count - bytes_left);
+	return written;
 }
 
 uint8_t fs_fgetc(fs_file_t* file) {
@@ -215,14 +830,15 @@ uint8_t fs_fgetc(fs_file_t* file) {
 	
 	if (0 != get_file_left_bytes(file)) {
 		if ( !end_of_cluster(file) ) {
-			err = fat32_find_next_cluster(file->partition, &file->current_cluster);
+			err = next_read_cluster(file);
 		}
 		if (FS_SUCCESS == err) {
 			err = read_file_buffer(file);
 			if (FS_SUCCESS == err) {
 				uint16_t sector_offset = get_offset_in_sector(file);
-				result = file->partition->device->buffer[sector_offset];
+				result = get_file_buffer(file)[sector_offset];
 				file->current_offset++;
+				file->eol_state = 0;
 			}
 		}
 	}
@@ -236,9 +852,9 @@ uint8_t* fs_fgets(fs_file_t* file, uint8_t* str, const uint16_t num) {
 
 	uint16_t result_offset = 0;
 	uint32_t file_left = get_file_left_bytes(file);
-	while (FS_SUCCESS == err && !end_of_line && 0 != file_left) {
+	while (FS_SUCCESS == err && !end_of_line && 0 != file_left && result_offset < num) {
 		if ( !end_of_cluster(file) ){
-			err = fat32_find_next_cluster(file->partition, &file->current_cluster);
+			err = next_read_cluster(file);
 		}
 		if (FS_SUCCESS == err) {
 			err = read_file_buffer(file);
@@ -250,7 +866,7 @@ uint8_t* fs_fgets(fs_file_t* file, uint8_t* str, const uint16_t num) {
 				if (bytes_to_copy > result_left) bytes_to_copy = result_left;
 
 				uint8_t* buffer = get_file_buffer(file);
-				end_of_line = find_eol_sequence(&buffer[sector_offset], &bytes_to_copy);
+				end_of_line = find_eol_sequence(file, &buffer[sector_offset], &bytes_to_copy);
 				memcpy(&str[result_offset], &buffer[sector_offset], bytes_to_copy);
 
 				file_left -= bytes_to_copy;
@@ -266,30 +882,24 @@ uint8_t* fs_fgets(fs_file_t* file, uint8_t* str, const uint16_t num) {
 fs_error fs_fputc(fs_file_t* file, const uint8_t character) {
 	uint8_t err = FS_SUCCESS;
 
-	// Allocate first cluster for empty file
-	if (0 == file->entry.file_size) {
-		fat32_alloc_new_cluster(file->partition, &file->entry.starting_cluster);
-		file->current_cluster = file->entry.starting_cluster;
+	// Move to next cluster for more file data
+	err = next_write_cluster(file);
+	if (FS_SUCCESS == err) {
+		err = load_write_buffer(file);   // Make sure internal buffer is valid
 	}
-
-	// Allocate next cluster for more file data
-	if (!end_of_cluster(file)) {
-		fat32_alloc_new_cluster(file->partition, &file->current_cluster);
+	if (FS_SUCCESS == err) {
+		err = set_file_pending_write(file);
 	}
-
-	err = read_file_buffer(file);   // Make sure internal buffer is valid
 	if (FS_SUCCESS == err) {
-		set_pending_write(file->partition->device);
-
 		uint16_t sector_offset = get_offset_in_sector(file);
 		uint8_t* buffer = get_file_buffer(file);
-		if (0 == sector_offset) {
-			memset(buffer, 0, SECTOR_SIZE);
-		}
 		buffer[sector_offset] = character;
 
 		file->current_offset++;
-		file->entry.file_size++;
+		file->eol_state = 0;
+		if (file->current_offset > file->entry.file_size) {
+			file->entry.file_size = file->current_offset;
+		}
 	}
 	
 
@@ -297,38 +907,46 @@ fs_error fs_fputc(fs_file_t* file, const uint8_t character) {
 }
 
 fs_error fs_fputs(fs_file_t* file, const uint8_t* str) {
+	uint32_t written = 0;
+	fs_const_iovec_t iov = { .base = str, .length = strlen(str) };
+	fs_iovec_cursor cursor = { .const_iov = &iov, .iovcnt = 1 };
+	return write_file_data(file, &cursor, iov.length, &written);
+}
+
+fs_error fs_fallocate(fs_file_t* file, const uint32_t size) {
 	fs_error err = FS_SUCCESS;
-	uint16_t str_len = strlen(str);
-	uint16_t bytes_left = str_len;
 
-	// Allocate first cluster for empty file
-	if (0 == file->entry.file_size) {
-		fat32_alloc_new_cluster(file->partition, &file->entry.starting_cluster);
-		file->current_cluster = file->entry.starting_cluster;
+	if (READ == file->mode) {
+		return FS_FILE_ACCES_FAIL;	// Read only handle cannot reserve space
 	}
 
-	while (FS_SUCCESS == err && bytes_left) {
-		if (!end_of_cluster(file)) {
-			fat32_alloc_new_cluster(file->partition, &file->current_cluster);
+	// Count clusters already linked to the file, starting from current one
+	uint32_t cluster_size = get_cluster_size(file);
+	uint32_t needed = size / cluster_size + (0 != size % cluster_size);
+	uint32_t last_cluster = 0;
+	uint32_t owned = 0;
+	if (0 != file->entry.starting_cluster && 0 != file->current_cluster) {
+		last_cluster = file->current_cluster;
+		owned = (file->current_offset ? (file->current_offset - 1) / cluster_size : 0) + 1;
+	}
+	while (FS_SUCCESS == err && owned && owned < needed) {
+		err = fat32_find_next_cluster(file->partition, &last_cluster);
+		if (FS_SUCCESS == err) cache_file_cluster(file, owned++, last_cluster);
+	}
+	if (FS_END_OF_CHAIN == err) {
+		err = FS_SUCCESS;
+	}
+
+	// Missing clusters are reserved as contiguous as free space allows
+	if (FS_SUCCESS == err && owned < needed) {
+		uint32_t first_cluster = 0;
+		err = fat32_alloc_cluster_run(file->partition, &last_cluster, needed - owned, &first_cluster);
+		if (0 == file->entry.starting_cluster && 0 != first_cluster) {
+			file->entry.starting_cluster = first_cluster;
+			file->current_cluster = first_cluster;
 		}
 		if (FS_SUCCESS == err) {
-			err = read_file_buffer(file);
-			if (FS_SUCCESS == err) {
-				set_pending_write(file->partition->device);
-
-				// Calculate bytes to copy to current sector
-				uint16_t sector_offset = get_offset_in_sector(file);
-				uint16_t bytes_to_copy = SECTOR_SIZE - sector_offset;
-				if (bytes_to_copy > bytes_left) bytes_to_copy = bytes_left;
-
-				uint8_t* buffer = get_file_buffer(file);
-				memcpy(&buffer[sector_offset], &str[(str_len - bytes_left)], bytes_to_copy);
-
-				bytes_left -= bytes_to_copy;
-				file->entry.file_size += bytes_to_copy;
-				file->current_offset += bytes_to_copy;
-			}
-
+			file->reserved = 1;	// File size is kept - reservation past it is released by fs_fclose
 		}
 	}
 
@@ -355,16 +973,15 @@ fs_error fs_fseek(fs_file_t* file, const uint32_t offset, const fs_seek origin)
 
 	if (new_offset <= file->entry.file_size) {
 		// Prevent loading cluster ahead of reading -> load cluster only if read is requested
-		uint8_t cluster_number = new_offset / (file->partition->sectors_per_cluster * SECTOR_SIZE);
+		uint32_t cluster_number = new_offset / (file->partition->sectors_per_cluster * SECTOR_SIZE);
 		if (cluster_number) cluster_number -= !(new_offset % (file->partition->sectors_per_cluster * SECTOR_SIZE));
 
-		uint32_t new_cluster = file->entry.starting_cluster;
-		for (uint8_t i = 0; i < cluster_number && !err; i++) {
-			err = fat32_find_next_cluster(file->partition, &new_cluster);
-		}
+		uint32_t new_cluster = 0;
+		err = seek_file_cluster(file, cluster_number, &new_cluster);
 		if (FS_SUCCESS == err) {
 			file->current_offset = new_offset;
 			file->current_cluster = new_cluster;
+			file->eol_state = 0;
 		}
 	}
 	else {
@@ -13,6 +13,7 @@
 #include "../slimfaterr.h"
 #include "../storage/storage.h"
 #include "../fat32/fat32.h"
+#include "../stats/stats.h"
 
 typedef enum {
 	READ,		/* Opens file for read only. File must exist*/
@@ -32,6 +33,28 @@ typedef enum {
 	FS_SEEK_END
 } fs_seek;
 
+typedef enum {
+	FS_EOL_CRLF,	/* Line ends with CR LF pair (default) */
+	FS_EOL_LF,		/* Line ends with LF */
+	FS_EOL_CR		/* Line ends with CR */
+} fs_eol_mode;
+
+typedef struct {
+	uint32_t file_cluster;	/* Index of first cluster of the run within file */
+	uint32_t disk_cluster;	/* First cluster of the run on partition */
+	uint32_t length;		/* Number of consecutive clusters */
+} fs_extent_t;
+
+typedef struct {
+	uint8_t* base;		/* Segment of user data filled by fs_freadv */
+	uint32_t length;	/* Size of segment in bytes */
+} fs_iovec_t;
+
+typedef struct {
+	const uint8_t* base;	/* Segment of user data stored by fs_fwritev */
+	uint32_t length;		/* Size of segment in bytes */
+} fs_const_iovec_t;
+
 typedef struct fs_generic_file {
 	// Partition on which file exists
 	fs_partition_t* partition;
@@ -41,21 +64,64 @@ typedef struct fs_generic_file {
 	fs_mode		mode;
 	uint32_t	current_cluster;
 	uint32_t	current_offset;
+	// Clusters past end of file were linked by fs_fallocate
+	uint8_t		reserved;
+	// Optional cache of cluster chain runs in caller provided memory
+	fs_extent_t* extents;
+	uint8_t		extent_slots;
+	uint8_t		extent_count;
+	// Optional private buffer of SECTOR_SIZE bytes in caller provided memory - current data sector of the handle
+	uint8_t*	buffer;
+	fs_cache_slot buffer_slot;
+	struct fs_generic_file* next_buffered;	// Next open handle with private buffer on the partition
+	// Line terminator recognized by fs_fgets and CR seen at the end of previous chunk
+	fs_eol_mode	eol_mode;
+	uint8_t		eol_state;
 } fs_file_t;
 
 #define GET_FILE_HANDLE(part) {.partition = &part}
+#define GET_EXTENT_FILE_HANDLE(part, ext, slots) {.partition = &part, .extents = ext, .extent_slots = slots}
+#define GET_BUFFERED_FILE_HANDLE(part, buff) {.partition = &part, .buffer = buff}
+
+typedef struct fs_generic_dir {
+	// Partition on which directory exists
+	fs_partition_t* partition;
+	// Position of next entry - zero cluster after last entry
+	uint32_t	dir_cluster;
+	uint16_t	dir_offset;
+} fs_dir_t;
+
+typedef struct {
+	// Short name in "name.ext" form
+	char		name[FAT_SHORT_NAME_LEN];
+	// Attributes, size and starting cluster
+	fat_entry_t	entry;
+} fs_dirent_t;
+
+#define GET_DIR_HANDLE(part) {.partition = &part}
 
 /* Partition operations */
 fs_error fs_mount(fs_partition_t* partition, const uint8_t partition_number);
+fs_error fs_sync(fs_partition_t* partition);
+fs_error fs_umount(fs_partition_t* partition);
 
 /* File access */
 fs_error fs_fopen(fs_file_t* file, const char* file_name, const fs_mode mode);
 fs_error fs_fclose(fs_file_t* file);
 fs_error fs_fflush(fs_file_t* file);
 
+/* Directory listing */
+fs_error fs_opendir(fs_dir_t* dir, const char* dir_name);
+fs_error fs_readdir(fs_dir_t* dir, fs_dirent_t* dirent);
+fs_error fs_closedir(fs_dir_t* dir);
+
 /* Direct input/output */
-uint16_t fs_fread(fs_file_t* file, uint8_t* ptr, const uint16_t count);
-uint16_t fs_fwrite(fs_file_t* file, const uint8_t* ptr, const uint16_t count);
+uint32_t fs_fread(fs_file_t* file, uint8_t* ptr, const uint32_t count);
+uint32_t fs_fwrite(fs_file_t* file, const uint8_t* ptr, const uint32_t count);
+
+/* Scatter/gather input/output - segments are transferred in a single pass as one contiguous block */
+uint32_t fs_freadv(fs_file_t* file, const fs_iovec_t* iov, const uint16_t iovcnt);
+uint32_t fs_fwritev(fs_file_t* file, const fs_const_iovec_t* iov, const uint16_t iovcnt);
 
 /* Character input/output */
 uint8_t  fs_fgetc(fs_file_t* file);
@@ -63,6 +129,9 @@ uint8_t* fs_fgets(fs_file_t* file, uint8_t* str, const uint16_t num);
 fs_error fs_fputc(fs_file_t* file, const uint8_t character);
 fs_error fs_fputs(fs_file_t* file, const uint8_t* str);
 
+/* Space reservation */
+fs_error fs_fallocate(fs_file_t* file, const uint32_t size);
+
 /* File positioning */
 fs_error fs_fseek(fs_file_t* file, const uint32_t offset, const fs_seek origin);
 uint32_t fs_ftell(const fs_file_t* file);
@@ -19,7 +19,9 @@ typedef enum {
 	FS_FILE_NOT_FOUND,
 	FS_INVALID_OFFSET,
 	FS_FILE_ACCES_FAIL,
-	FS_UNSUPPORTED_MODE
+	FS_UNSUPPORTED_MODE,
+	FS_DISK_FULL,
+	FS_END_OF_DIR
 } fs_error;
 
 #endif /* SLIMFATERR_H_ */
\ No newline at end of file
@@ -0,0 +1,28 @@
+#include "stats.h"
+
+#ifdef SLIMFAT_STATS
+
+#include <string.h>
+
+fs_stats_t fs_stats;
+
+static uint32_t last_written_sector = UINT32_MAX;
+
+void fs_stats_count_writes(const uint32_t sector, const uint32_t count) {
+	if (sector == last_written_sector) {
+		fs_stats.redundant_writes++;
+	}
+	fs_stats.sector_writes += count;
+	last_written_sector = sector + count - 1;
+}
+
+void fs_get_stats(fs_stats_t* stats) {
+	memcpy(stats, &fs_stats, sizeof(fs_stats_t));
+}
+
+void fs_reset_stats(void) {
+	memset(&fs_stats, 0, sizeof(fs_stats_t));
+	last_written_sector = UINT32_MAX;
+}
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * stats.h
+ *
+ * Created: 17.10.2026 13:18:52
+ * Author : agent
+ */
+
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdint.h>
+
+/* I/O instrumentation is compiled in only when SLIMFAT_STATS is defined */
+#ifdef SLIMFAT_STATS
+
+typedef struct {
+	/* Storage layer */
+	uint32_t sector_reads;			// Sectors read from storage media
+	uint32_t sector_writes;			// Sectors written to storage media - synchronized modified sectors of mapped device
+	uint32_t buffer_hits;			// Buffered sector requests served without media access
+	uint32_t redundant_writes;		// Sector written again right after it was written
+	/* FAT32 layer */
+	uint32_t fat_lookups;			// FAT sector lookups while following cluster chain
+	uint32_t alloc_scanned_sectors;	// FAT sectors scanned looking for free cluster
+	uint32_t dir_scanned_sectors;	// Directory sectors scanned looking for entry
+} fs_stats_t;
+
+extern fs_stats_t fs_stats;
+
+void fs_stats_count_writes(const uint32_t sector, const uint32_t count);
+
+#define FS_STATS_ADD(counter, value)	(fs_stats.counter += (value))
+#define FS_STATS_WRITES(sector, count)	fs_stats_count_writes((sector), (count))
+
+void fs_get_stats(fs_stats_t* stats);
+void fs_reset_stats(void);
+
+#else
+
+#define FS_STATS_ADD(counter, value)	((void)0)
+#define FS_STATS_WRITES(sector, count)	((void)0)
+
+#endif
+
+#define FS_STATS_INC(counter)			FS_STATS_ADD(counter, 1)
+
+#endif /* STATS_H_ */
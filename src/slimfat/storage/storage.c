@@ -1,18 +1,167 @@
 #include "storage.h"
 
 #include <string.h>
+#include "../stats/stats.h"
 
 uint8_t validate_signature(uint8_t* buffer) {
 	return (buffer[510] != 0x55 || buffer[511] != 0xAA);
 }
 
+uint8_t* get_slot_buffer(fs_storage_device* device, const uint8_t slot) {
+	return &device->buffer[slot * SECTOR_SIZE];
+}
+
+uint8_t find_cached_slot(fs_storage_device* device, const uint32_t sector) {
+	uint8_t slot = 0;
+	for (; slot < device->slot_count; slot++) {
+		fs_cache_slot* entry = &device->slots[slot];
+		if ((entry->status & SLOT_VALID) && entry->sector == sector) break;
+	}
+	return slot;	// slot_count on miss
+}
+
+uint8_t find_victim_slot(fs_storage_device* device) {
+	uint8_t victim = 0;
+	for (uint8_t slot = 0; slot < device->slot_count; slot++) {
+		if (!(device->slots[slot].status & SLOT_VALID)) return slot;	// Prefer unused slot
+		if (device->slots[slot].age > device->slots[victim].age) victim = slot;
+	}
+	return victim;
+}
+
+void touch_slot(fs_storage_device* device, const uint8_t slot) {
+	for (uint8_t i = 0; i < device->slot_count; i++) {
+		if (device->slots[i].age < UINT8_MAX) device->slots[i].age++;
+	}
+	device->slots[slot].age = 0;
+	device->current = slot;
+}
+
+fs_error flush_slot(fs_storage_device* device, const uint8_t slot) {
+	fs_error err = FS_SUCCESS;
+
+	fs_cache_slot* entry = &device->slots[slot];
+	if ((entry->status & (SLOT_VALID | SLOT_DIRTY)) == (SLOT_VALID | SLOT_DIRTY)) {
+		FS_STATS_WRITES(entry->sector, 1);
+		if (device->write_sector(device->disk, entry->sector, get_slot_buffer(device, slot))) {
+			err = FS_WRITE_FAIL;
+		}
+		else {
+			entry->status &= ~SLOT_DIRTY;	// Cleared only after successful write
+		}
+	}
+
+	return err;
+}
+
+fs_error claim_slot(fs_storage_device* device, const uint32_t sector, uint8_t* slot) {
+	fs_error err = FS_SUCCESS;
+
+	*slot = find_victim_slot(device);
+	err = flush_slot(device, *slot);
+	if (FS_SUCCESS == err) {	// Victim keeps its pending data when flush failed
+		device->slots[*slot].sector = sector;
+		device->slots[*slot].status = SLOT_VALID;
+		touch_slot(device, *slot);
+	}
+
+	return err;
+}
+
+fs_error map_current_sector(fs_storage_device* device, const uint32_t sector) {
+	fs_error err = FS_SUCCESS;
+
+	uint8_t* mapped = device->map_sector(device->disk, sector);
+	if (mapped) {
+		device->mapped = mapped;
+		device->mapped_sector = sector;
+	}
+	else {
+		err = FS_READ_FAIL;
+	}
+
+	return err;
+}
+
+fs_error sync_mapped_sectors(fs_storage_device* device) {
+	fs_error err = FS_SUCCESS;
+
+	for (uint8_t range_id = 0; range_id < device->sync_count; range_id++) {
+		fs_sector_range* range = &device->sync_ranges[range_id];
+		FS_STATS_WRITES(range->first, range->last - range->first + 1);
+		if (device->sync_sectors(device->disk, range->first, range->last - range->first + 1)) {
+			err = FS_WRITE_FAIL;
+		}
+	}
+	device->sync_count = 0;
+
+	return err;
+}
+
+fs_error add_sync_range(fs_storage_device* device, const uint32_t sector, const uint32_t count) {
+	fs_error err = FS_SUCCESS;
+
+	// Adjacent or overlapping sectors extend existing range
+	uint8_t range_id = 0;
+	for (; range_id < device->sync_count; range_id++) {
+		fs_sector_range* range = &device->sync_ranges[range_id];
+		if (sector <= range->last + 1 && sector + count >= range->first) break;
+	}
+	if (range_id == device->sync_count) {
+		// All ranges used - synchronize them instead of joining them over clean sectors
+		if (MAPPED_SYNC_RANGES == device->sync_count) {
+			err = sync_mapped_sectors(device);
+			range_id = 0;
+		}
+		device->sync_ranges[range_id].first = sector;
+		device->sync_ranges[range_id].last = sector + count - 1;
+		device->sync_count = range_id + 1;
+	}
+	else {
+		fs_sector_range* range = &device->sync_ranges[range_id];
+		if (range->first > sector) range->first = sector;
+		if (range->last < sector + count - 1) range->last = sector + count - 1;
+		// Grown range may reach other ranges - join them so no sector is synchronized and counted twice
+		uint8_t other = 0;
+		while (other < device->sync_count) {
+			range = &device->sync_ranges[range_id];
+			fs_sector_range* joined = &device->sync_ranges[other];
+			if (other != range_id && joined->first <= range->last + 1 && joined->last + 1 >= range->first) {
+				if (range->first > joined->first) range->first = joined->first;
+				if (range->last < joined->last) range->last = joined->last;
+				device->sync_count--;
+				*joined = device->sync_ranges[device->sync_count];
+				if (range_id == device->sync_count) range_id = other;
+			}
+			else {
+				other++;
+			}
+		}
+	}
+
+	return err;
+}
+
+fs_error mark_mapped_sectors(fs_storage_device* device, const uint32_t sector, const uint32_t count) {
+	fs_error err = FS_SUCCESS;
+
+	err = add_sync_range(device, sector, count);
+	if (FS_WRITE_THROUGH == device->policy) {
+		fs_error sync_err = sync_mapped_sectors(device);
+		if (FS_SUCCESS == err) err = sync_err;
+	}
+
+	return err;
+}
+
 fs_error find_partition(fs_storage_device* device, const uint8_t partition_number, uint32_t* sector) {
 	fs_error err = FS_SUCCESS;
 
 	err = read_buffered_sector(device, 0);	// Expected to see MBR (Master Boot Record)
 	if (FS_SUCCESS == err) {
-		if (!validate_signature(device->buffer)) {
-			uint8_t* partition_entry = &device->buffer[0x01BE + (partition_number * 16)];
+		uint8_t* mbr = get_raw_buffer(device);
+		if (!validate_signature(mbr)) {
+			uint8_t* partition_entry = &mbr[0x01BE + (partition_number * 16)];
 			memcpy(sector, &partition_entry[8], sizeof(uint32_t));
 		}
 		else {
@@ -26,38 +175,232 @@ fs_error find_partition(fs_storage_device* device, const uint8_t partition_numbe
 fs_error read_buffered_sector(fs_storage_device* device, const uint32_t sector) {
 	fs_error err = FS_SUCCESS;
 
-	if (device->sector != sector || 0 == sector) {
-		if (1 == device->status) {
-			device->status = 0;	// Make sure this is clear after successful write
-			if (device->write_sector(device->disk, device->sector, device->buffer)) {
+	uint8_t slot = find_cached_slot(device, sector);
+	if (device->map_sector) {
+		device->hits++;	// Mapped sectors never have to be loaded
+		FS_STATS_INC(buffer_hits);
+		err = map_current_sector(device, sector);
+	}
+	else if (slot < device->slot_count) {
+		device->hits++;
+		FS_STATS_INC(buffer_hits);
+		touch_slot(device, slot);
+	}
+	else {
+		device->misses++;
+		FS_STATS_INC(sector_reads);
+		err = claim_slot(device, sector, &slot);
+		if (FS_SUCCESS == err && device->read_sector(device->disk, sector, get_slot_buffer(device, slot))) {
+			device->slots[slot].status = 0;	// Do not keep invalid data
+			err = FS_READ_FAIL;
+		}
+	}
+
+	return err;
+}
+
+fs_error write_buffered_sector(fs_storage_device* device, const uint32_t sector) {
+	fs_error err = FS_SUCCESS;
+
+	if (device->map_sector) {
+		if (device->mapped_sector != sector) {
+			// Current buffer contents become the new sector data
+			uint8_t* current = device->mapped;
+			err = map_current_sector(device, sector);
+			if (FS_SUCCESS == err) memmove(device->mapped, current, SECTOR_SIZE);
+		}
+		if (FS_SUCCESS == err) err = mark_mapped_sectors(device, sector, 1);
+	}
+	else {
+		uint8_t slot = find_cached_slot(device, sector);
+		if (slot >= device->slot_count) {
+			// Sector is not cached - current buffer contents become the new sector data
+			slot = device->current;
+			err = flush_slot(device, slot);	// Pending data of previous sector must not be lost
+			if (FS_SUCCESS == err) device->slots[slot].sector = sector;
+		}
+		if (FS_SUCCESS == err) {
+			device->slots[slot].status = SLOT_VALID | SLOT_DIRTY;
+			touch_slot(device, slot);
+			if (FS_WRITE_THROUGH == device->policy) {
+				err = flush_slot(device, slot);
+			}
+		}
+	}
+
+	return err;
+}
+
+fs_error clear_buffered_sector(fs_storage_device* device, const uint32_t sector) {
+	fs_error err = FS_SUCCESS;
+
+	uint8_t slot = find_cached_slot(device, sector);
+	if (device->map_sector) {
+		err = map_current_sector(device, sector);
+		if (FS_SUCCESS == err) {
+			memset(device->mapped, 0, SECTOR_SIZE);
+			err = mark_mapped_sectors(device, sector, 1);
+		}
+	}
+	else {
+		if (slot < device->slot_count) {
+			touch_slot(device, slot);
+		}
+		else {
+			err = claim_slot(device, sector, &slot);
+		}
+		if (FS_SUCCESS == err) {
+			memset(get_slot_buffer(device, slot), 0, SECTOR_SIZE);
+			device->slots[slot].status |= SLOT_DIRTY;
+			if (FS_WRITE_THROUGH == device->policy) {
+				err = flush_slot(device, slot);
+			}
+		}
+	}
+
+	return err;
+}
+
+fs_error flush_buffered_sectors(fs_storage_device* device) {
+	fs_error err = FS_SUCCESS;
+
+	if (device->map_sector) {
+		err = sync_mapped_sectors(device);
+	}
+
+	// Store dirty slots in ascending sector order - slot which failed stays dirty and is passed over
+	uint8_t found = 1;
+	uint8_t stored = 0;
+	uint32_t last_sector = 0;
+	while (found) {
+		found = 0;
+		uint8_t next = 0;
+		for (uint8_t slot = 0; slot < device->slot_count; slot++) {
+			fs_cache_slot* entry = &device->slots[slot];
+			if ((entry->status & SLOT_DIRTY) && (!stored || entry->sector > last_sector) && (!found || entry->sector < device->slots[next].sector)) {
+				next = slot;
+				found = 1;
+			}
+		}
+		if (found) {
+			if (FS_SUCCESS != flush_slot(device, next)) {
 				err = FS_WRITE_FAIL;
 			}
+			last_sector = device->slots[next].sector;
+			stored = 1;
 		}
-		device->sector = sector;
-		if (device->read_sector(device->disk, sector, device->buffer)) {
+	}
+
+	return err;
+}
+
+fs_error read_direct_sectors(fs_storage_device* device, const uint32_t sector, const uint16_t count, uint8_t* buffer) {
+	fs_error err = FS_SUCCESS;
+
+	if (device->map_sector) {
+		for (uint16_t i = 0; i < count && FS_SUCCESS == err; i++) {
+			uint8_t* mapped = device->map_sector(device->disk, sector + i);
+			if (mapped) memcpy(&buffer[i * SECTOR_SIZE], mapped, SECTOR_SIZE);
+			else err = FS_READ_FAIL;
+		}
+	}
+	else if (device->read_sectors) {
+		FS_STATS_ADD(sector_reads, count);
+		if (device->read_sectors(device->disk, sector, count, buffer)) {
 			err = FS_READ_FAIL;
 		}
 	}
+	else {
+		for (uint16_t i = 0; i < count && FS_SUCCESS == err; i++) {
+			FS_STATS_INC(sector_reads);
+			if (device->read_sector(device->disk, sector + i, &buffer[i * SECTOR_SIZE])) {
+				err = FS_READ_FAIL;
+			}
+		}
+	}
+	// Cached sectors may hold data not yet stored on the device
+	for (uint8_t slot = 0; slot < device->slot_count && FS_SUCCESS == err; slot++) {
+		fs_cache_slot* entry = &device->slots[slot];
+		if ((entry->status & SLOT_VALID) && entry->sector >= sector && entry->sector - sector < count) {
+			memcpy(&buffer[(entry->sector - sector) * SECTOR_SIZE], get_slot_buffer(device, slot), SECTOR_SIZE);
+		}
+	}
 
 	return err;
 }
 
-fs_error write_buffered_sector(fs_storage_device* device, const uint32_t sector) {
+fs_error write_direct_sectors(fs_storage_device* device, const uint32_t sector, const uint16_t count, const uint8_t* buffer) {
+	fs_error err = FS_SUCCESS;
+
+	if (device->map_sector) {
+		for (uint16_t i = 0; i < count && FS_SUCCESS == err; i++) {
+			uint8_t* mapped = device->map_sector(device->disk, sector + i);
+			if (mapped) memcpy(mapped, &buffer[i * SECTOR_SIZE], SECTOR_SIZE);
+			else err = FS_WRITE_FAIL;
+		}
+		if (FS_SUCCESS == err) err = mark_mapped_sectors(device, sector, count);
+	}
+	else if (device->write_sectors) {
+		FS_STATS_WRITES(sector, count);
+		if (device->write_sectors(device->disk, sector, count, buffer)) {
+			err = FS_WRITE_FAIL;
+		}
+	}
+	else {
+		for (uint16_t i = 0; i < count && FS_SUCCESS == err; i++) {
+			FS_STATS_WRITES(sector + i, 1);
+			if (device->write_sector(device->disk, sector + i, &buffer[i * SECTOR_SIZE])) {
+				err = FS_WRITE_FAIL;
+			}
+		}
+	}
+	// Keep cached copies of overwritten sectors up to date
+	for (uint8_t slot = 0; slot < device->slot_count; slot++) {
+		fs_cache_slot* entry = &device->slots[slot];
+		if ((entry->status & SLOT_VALID) && entry->sector >= sector && entry->sector - sector < count) {
+			memcpy(get_slot_buffer(device, slot), &buffer[(entry->sector - sector) * SECTOR_SIZE], SECTOR_SIZE);
+			if (FS_SUCCESS == err) entry->status &= ~SLOT_DIRTY;
+			else entry->status |= SLOT_DIRTY;	// Retry on next flush
+		}
+	}
+
+	return err;
+}
+
+fs_error erase_direct_sectors(fs_storage_device* device, const uint32_t sector, const uint32_t count) {
 	fs_error err = FS_SUCCESS;
 
-	device->status = 0;	// Make sure this is clear after successful write
-	device->sector = sector;
-	if (device->write_sector(device->disk, sector, device->buffer)) {
-		err = FS_WRITE_FAIL;
+	if (device->erase_sectors) {
+		// Cached copies of erased sectors must never be written back
+		for (uint8_t slot = 0; slot < device->slot_count; slot++) {
+			fs_cache_slot* entry = &device->slots[slot];
+			if ((entry->status & SLOT_VALID) && entry->sector >= sector && entry->sector - sector < count) {
+				entry->status = 0;
+			}
+		}
+		if (device->erase_sectors(device->disk, sector, count)) {
+			err = FS_WRITE_FAIL;
+		}
 	}
 
 	return err;
 }
 
 uint8_t* get_raw_buffer(fs_storage_device* device) {
-	return device->buffer;
+	if (device->map_sector) return device->mapped;
+	return get_slot_buffer(device, device->current);
 }
 
-void set_pending_write(fs_storage_device* device) {
-	device->status = 1;
+fs_error set_pending_write(fs_storage_device* device) {
+	fs_error err = FS_SUCCESS;
+
+	if (device->map_sector) {
+		// Modified in place - only remember range to be synchronized
+		err = add_sync_range(device, device->mapped_sector, 1);
+	}
+	else {
+		device->slots[device->current].status |= SLOT_DIRTY;
+	}
+
+	return err;
 }
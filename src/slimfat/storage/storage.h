@@ -2,8 +2,8 @@
  * storage.h
  *
  * Created: 24.09.2020 17:22:04
- * Author : Micha Granda
- */ 
+ * Author : Michał Granda
+ */
 
 
 #ifndef STORAGE_H_
@@ -15,25 +15,75 @@
 
 #define SECTOR_SIZE 512
 
+/* Cache slot status flags */
+#define SLOT_VALID	0x01
+#define SLOT_DIRTY	0x02
+
+/* Number of separate ranges of modified sectors remembered by mapped device */
+#define MAPPED_SYNC_RANGES 4
+
+typedef enum {
+	FS_WRITE_THROUGH,	/* Sectors written with write_buffered_sector are stored immediately */
+	FS_WRITE_BACK		/* Modified sectors are stored on eviction or flush only */
+} fs_write_policy;
+
+typedef struct {
+	/* Sector held in slot */
+	uint32_t sector;
+	/* Slot status flags */
+	uint8_t status;
+	/* Accesses since last use - the oldest slot is evicted first */
+	uint8_t age;
+} fs_cache_slot;
+
+typedef struct {
+	uint32_t first;
+	uint32_t last;
+} fs_sector_range;
+
 typedef struct {
 	/* Storage media object */
 	void* disk;
-	/* Storage media status */
-	uint8_t status;
-	/* Buffered operations */
-	uint32_t sector;
+	/* Buffered operations - slot_count sectors of buffer memory */
 	uint8_t* buffer;
+	fs_cache_slot* slots;
+	uint8_t slot_count;
+	uint8_t current;
+	fs_write_policy policy;
+	/* Cache statistics */
+	uint32_t hits;
+	uint32_t misses;
 	/* Function pointers to access raw data */
 	uint8_t(*read_sector)(void*, const uint32_t, uint8_t*);
 	uint8_t(*write_sector)(void*, const uint32_t, const uint8_t*);
+	/* Optional function pointers to access multiple consecutive sectors */
+	uint8_t(*read_sectors)(void*, const uint32_t, const uint16_t, uint8_t*);
+	uint8_t(*write_sectors)(void*, const uint32_t, const uint16_t, const uint8_t*);
+	/* Optional erase hint - contents of released sectors are no longer needed */
+	uint8_t(*erase_sectors)(void*, const uint32_t, const uint32_t);
+	/* Optional memory mapped access - sectors are accessed in place instead of being buffered */
+	uint8_t*(*map_sector)(void*, const uint32_t);
+	uint8_t(*sync_sectors)(void*, const uint32_t, const uint32_t);
+	/* Mapped operations - current sector and ranges of modified sectors */
+	uint8_t* mapped;
+	uint32_t mapped_sector;
+	fs_sector_range sync_ranges[MAPPED_SYNC_RANGES];
+	uint8_t sync_count;
 } fs_storage_device;
 
-#define GET_DEV_HANDLE(buff, dev, read, write) {.disk = dev, .status = 0, .buffer = buff,  .read_sector = read, .write_sector = write }
+#define GET_CACHED_DEV_HANDLE(buff, slot_buff, count, dev, read, write) {.disk = dev, .buffer = buff, .slots = slot_buff, .slot_count = count, .current = 0, .policy = FS_WRITE_THROUGH, .read_sector = read, .write_sector = write }
+#define GET_DEV_HANDLE(buff, dev, read, write) GET_CACHED_DEV_HANDLE(buff, ((fs_cache_slot[1]){ { 0 } }), 1, dev, read, write)
+#define GET_MAPPED_DEV_HANDLE(dev, map, sync) {.disk = dev, .policy = FS_WRITE_BACK, .map_sector = map, .sync_sectors = sync }
 
 fs_error find_partition(fs_storage_device* device, const uint8_t partition_number, uint32_t* sector);
 fs_error read_buffered_sector(fs_storage_device* device, const uint32_t sector);
 fs_error write_buffered_sector(fs_storage_device* device, const uint32_t sector);
+fs_error clear_buffered_sector(fs_storage_device* device, const uint32_t sector);
+fs_error flush_buffered_sectors(fs_storage_device* device);
+fs_error read_direct_sectors(fs_storage_device* device, const uint32_t sector, const uint16_t count, uint8_t* buffer);
+fs_error write_direct_sectors(fs_storage_device* device, const uint32_t sector, const uint16_t count, const uint8_t* buffer);
+fs_error erase_direct_sectors(fs_storage_device* device, const uint32_t sector, const uint32_t count);
 uint8_t* get_raw_buffer(fs_storage_device* device);
-void set_pending_write(fs_storage_device* device);
+fs_error set_pending_write(fs_storage_device* device);
 
 #endif /* STORAGE_H_ */
\ No newline at end of file